@@ -0,0 +1,3 @@
+# 递归的斐波那契 函数调用与比较、分支
+def fib(n) if n < 2 { n; } else { fib(n - 1) + fib(n - 2); }
+fib(32);
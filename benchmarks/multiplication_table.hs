@@ -0,0 +1,31 @@
+# README中的九九乘法表(嵌套循环、运算符、extern调用) 重复打印多次
+extern printNum(x);
+extern putchard(x);
+extern endl();
+extern tab();
+def binary@+= 2 (LHS RHS) {
+  LHS = LHS + RHS;
+}
+def binary@, 1 (LHS RHS) {
+  LHS;
+  RHS;
+}
+def table() {
+  for i=1;i<10;i+=1{
+    for j=1;j<i;j+=1 {
+      tab();
+    }
+    for j=i;j<10;j+=1 {
+        printNum(i) , putchard(42) , printNum(j) , putchard(61) ,
+        printNum(i*j) ,
+        tab();
+    }
+    endl();
+  }
+}
+def repeat(n) {
+  for k=0;k<n;k+=1 {
+    table();
+  }
+}
+repeat(200);
@@ -0,0 +1,61 @@
+# 用户定义的单目/双目运算符 增量模式下运算符的函数体被内联到调用者中
+def unary@!(v) {
+  if v {
+    0;
+  }
+  else {
+    1;
+  }
+}
+def unary@-(v) 0 - v;
+def binary@|| 5 (LHS RHS){
+  if LHS {
+    1;
+  }
+  else if RHS{
+    1;
+  }
+  else{
+    0;
+  }
+}
+def binary@&& 5 (LHS RHS){
+  var flag = 1;
+  if !LHS {
+    flag = 0;
+  }
+  if !RHS {
+    flag = 0;
+  }
+  flag;
+}
+def binary@> 10 (LHS RHS) {
+  RHS < LHS;
+}
+def binary@== 10 (LHS RHS) {
+  !(LHS < RHS || LHS > RHS);
+}
+def binary@<= 10 (LHS RHS) {
+  (LHS < RHS) || (LHS == RHS);
+}
+def binary@+= 2 (LHS RHS) {
+  LHS = LHS + RHS;
+}
+def binary@% 50 (LHS RHS) {
+  var r = LHS;
+  for i = RHS; i <= LHS; i += RHS {
+    r = r - RHS;
+  }
+  r;
+}
+def score(i) {
+  -(i % 7) * (i > 50 && !(i == 77)) + (i <= 10 || i > 900) + (i % 3 == 0) * 2;
+}
+def arith(n) {
+  var acc = 0;
+  for i = 1; i <= n; i += 1 {
+    acc = acc + score(i);
+  }
+  acc;
+}
+arith(2000);
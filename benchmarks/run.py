@@ -0,0 +1,188 @@
+#!/usr/bin/env python3
+"""
+Hoshino的端到端基准测试
+对benchmarks/下的每个程序与每种编译配置运行若干次 取中位数:
+  wall_ms     进程从启动到退出的时间(startup.hs的wall_ms即冷启动延迟)
+  compile_ms  --time-report中lex、parse、codegen、jit-add、optimize、emit-object、link的墙钟时间之和
+              JIT的编译在编译线程中进行 与执行重叠 因此可能大于wall_ms
+  execute_ms  顶层表达式的执行时间(包含其中惰性编译所等待的时间)
+  rss_kb      进程的峰值常驻内存
+与保存的基线(--baseline)比较 某项同时超出相对容差与绝对容差时视为性能回退 以非0退出
+没有基线文件或基线中缺少某项时同样以非0退出 除非指定--allow-missing-baseline
+"""
+import argparse
+import json
+import os
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+
+# 配置名 -> 额外的命令行选项 hoshino没有-O级别 这里比较的是编译方式
+CONFIGS = {
+    "jit": [],
+    "jitlink": ["--jitlink"],
+    "whole-program": ["--whole-program"],
+}
+
+COMPILE_PHASES = ["lex", "parse", "codegen", "jit-add", "optimize", "emit-object", "link"]
+METRICS = ["wall_ms", "compile_ms", "execute_ms", "rss_kb"]
+
+
+def generate_programs(directory):
+    """生成的程序: 大量很小的定义 以及大量顶层语句 考察前端与每个module的固定开销"""
+    programs = {}
+    path = os.path.join(directory, "many_defs.hs")
+    with open(path, "w") as out:
+        out.write("# 500个很小的函数 每个调用前一个\n")
+        out.write("def f0(x) x + 1;\n")
+        for i in range(1, 500):
+            out.write("def f%d(x) f%d(x) * 1 + %d;\n" % (i, i - 1, i % 7))
+        out.write("f499(1);\n")
+    programs["many_defs"] = path
+    path = os.path.join(directory, "many_statements.hs")
+    with open(path, "w") as out:
+        out.write("# 2000个顶层表达式 每个都单独编译、执行、移除\n")
+        out.write("def g(x) x * 2 + 1;\n")
+        for i in range(2000):
+            out.write("g(%d) + %d;\n" % (i, i % 13))
+    programs["many_statements"] = path
+    return programs
+
+
+def corpus(directory):
+    programs = {}
+    for name in sorted(os.listdir(HERE)):
+        if name.endswith(".hs"):
+            programs[name[:-3]] = os.path.join(HERE, name)
+    programs.update(generate_programs(directory))
+    return programs
+
+
+def run_once(hoshino, program, options, directory):
+    report = os.path.join(directory, "time-report.json")
+    command = [hoshino] + options + ["--time-report=json", "--time-report-file=" + report, program]
+    start = time.perf_counter()
+    process = subprocess.Popen(command, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL,
+                               cwd=directory)
+    _, status, usage = os.wait4(process.pid, 0)
+    wall = time.perf_counter() - start
+    if os.waitstatus_to_exitcode(status) != 0:
+        raise RuntimeError("%s exited with status %d" % (" ".join(command),
+                                                          os.waitstatus_to_exitcode(status)))
+    with open(report) as f:
+        phases = json.load(f)["phases"]
+    return {
+        "wall_ms": wall * 1e3,
+        "compile_ms": sum(phases[p]["wall_ms"] for p in COMPILE_PHASES),
+        "execute_ms": phases["execute"]["wall_ms"],
+        # Linux上ru_maxrss的单位为KB
+        "rss_kb": usage.ru_maxrss,
+    }
+
+
+def measure(hoshino, programs, configs, repeat, directory):
+    results = {}
+    for name, program in programs.items():
+        for config in configs:
+            runs = [run_once(hoshino, program, CONFIGS[config], directory) for _ in range(repeat)]
+            results["%s/%s" % (name, config)] = {
+                metric: statistics.median(run[metric] for run in runs) for metric in METRICS
+            }
+            row = results["%s/%s" % (name, config)]
+            print("%-36s %10.2f %10.2f %10.2f %10d" % ("%s/%s" % (name, config), row["wall_ms"],
+                  row["compile_ms"], row["execute_ms"], row["rss_kb"]), flush=True)
+    return results
+
+
+def compare(results, baseline, tolerance, min_ms, min_kb):
+    """返回回退的项与基线中没有的项 回退指某项比基线慢(大)超过tolerance倍 且差值超过绝对容差"""
+    regressions = []
+    missing = []
+    for key, row in sorted(results.items()):
+        base = baseline.get(key)
+        if base is None:
+            missing.append(key)
+            continue
+        for metric in METRICS:
+            if metric not in base:
+                continue
+            floor = min_kb if metric == "rss_kb" else min_ms
+            delta = row[metric] - base[metric]
+            if delta > floor and row[metric] > base[metric] * (1 + tolerance):
+                regressions.append((key, metric, base[metric], row[metric]))
+    return regressions, missing
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Run the Hoshino benchmark corpus")
+    parser.add_argument("--hoshino", required=True, help="path to the hoshino executable")
+    parser.add_argument("--baseline", default=os.path.join(HERE, "baseline.json"),
+                        help="baseline results to compare against (default benchmarks/baseline.json)")
+    parser.add_argument("--update-baseline", action="store_true",
+                        help="write the results to --baseline instead of comparing")
+    parser.add_argument("--allow-missing-baseline", action="store_true",
+                        help="do not fail when the baseline file or an entry in it is missing")
+    parser.add_argument("--output", help="also write the results as JSON to this file")
+    parser.add_argument("--repeat", type=int, default=5, help="runs per benchmark, the median is kept")
+    parser.add_argument("--configs", default=",".join(CONFIGS),
+                        help="comma separated configurations: " + ", ".join(CONFIGS))
+    parser.add_argument("--filter", default="", help="only run benchmarks whose name contains this")
+    parser.add_argument("--tolerance", type=float, default=0.10,
+                        help="allowed relative slowdown before a regression is reported (default 0.10)")
+    parser.add_argument("--min-ms", type=float, default=2.0,
+                        help="ignore time differences smaller than this many ms (default 2)")
+    parser.add_argument("--min-kb", type=int, default=1024,
+                        help="ignore memory differences smaller than this many KB (default 1024)")
+    args = parser.parse_args()
+
+    configs = [c for c in args.configs.split(",") if c]
+    for config in configs:
+        if config not in CONFIGS:
+            parser.error("unknown configuration '%s'" % config)
+    # 没有基线时比较不出任何回退 不运行就失败
+    if not args.update_baseline and not args.allow_missing_baseline and not os.path.exists(args.baseline):
+        print("no baseline at %s, run with --update-baseline to record one" % args.baseline)
+        return 1
+    hoshino = os.path.abspath(args.hoshino)
+    with tempfile.TemporaryDirectory(prefix="hoshino-bench-") as directory:
+        programs = {name: path for name, path in corpus(directory).items() if args.filter in name}
+        print("%-36s %10s %10s %10s %10s" % ("benchmark", "wall(ms)", "compile", "execute", "rss(KB)"))
+        results = measure(hoshino, programs, configs, args.repeat, directory)
+
+    if args.output:
+        with open(args.output, "w") as f:
+            json.dump(results, f, indent=2, sort_keys=True)
+    if args.update_baseline:
+        baseline = {}
+        if os.path.exists(args.baseline):
+            with open(args.baseline) as f:
+                baseline = json.load(f)
+        baseline.update(results)
+        with open(args.baseline, "w") as f:
+            json.dump(baseline, f, indent=2, sort_keys=True)
+            f.write("\n")
+        print("baseline written to %s" % args.baseline)
+        return 0
+    if not os.path.exists(args.baseline):
+        print("no baseline at %s, nothing compared" % args.baseline)
+        return 0
+    with open(args.baseline) as f:
+        baseline = json.load(f)
+    regressions, missing = compare(results, baseline, args.tolerance, args.min_ms, args.min_kb)
+    for key, metric, before, after in regressions:
+        print("REGRESSION %s %s: %.2f -> %.2f (%+.1f%%)" % (key, metric, before, after,
+              100.0 * (after - before) / before if before else float("inf")))
+    for key in missing:
+        print("MISSING %s: not in %s, run with --update-baseline to record it" % (key, args.baseline))
+    if regressions or (missing and not args.allow_missing_baseline):
+        return 1
+    print("no regressions against %s (tolerance %.0f%%)" % (args.baseline, args.tolerance * 100))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
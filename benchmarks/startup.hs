@@ -0,0 +1,2 @@
+# 冷启动: 只有一个顶层表达式 时间主要是进程启动与JIT的初始化
+0;
@@ -1,8 +1,13 @@
 #include "lib.h"
-#include <cstdio>
+#include "output.h"
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+
+using namespace hoshino;
 
 extern "C" DLLEXPORT double putchard(double x){
-    fputc((char)x, stderr);
+    output::Put((char)x);
     return 0;
 }
 
@@ -14,10 +19,29 @@ extern "C" DLLEXPORT double endl() {
     return putchard(10);
 }
 
+// 打印x的整数部分(向零取整) 超出int64范围时打印完整的十进制数字 nan与inf打印为nan/inf
 extern "C" DLLEXPORT double printNum(double x){
-    char outputs[10] = {};
-    int num = (int)x;
-    sprintf(outputs, "%d", num);
-    fputs(outputs, stderr);
+    // 最大的double有309位整数
+    char digits[320];
+    std::to_chars_result result;
+    if(x > -9.2e18 && x < 9.2e18)
+        result = std::to_chars(digits, digits + sizeof(digits), static_cast<int64_t>(x));
+    else
+        result = std::to_chars(digits, digits + sizeof(digits), std::trunc(x), std::chars_format::fixed);
+    output::Write(digits, result.ptr - digits);
+    return 0;
+}
+
+// 打印x的最短的能够精确还原的十进制表示 比如0.1、1e+100
+extern "C" DLLEXPORT double printFloat(double x){
+    char digits[32];
+    auto result = std::to_chars(digits, digits + sizeof(digits), x);
+    output::Write(digits, result.ptr - digits);
+    return 0;
+}
+
+extern "C" DLLEXPORT double memoStats(){
+    output::Flush();
+    hoshino_memo_print_stats(output::Sink(), "");
     return 0;
 }
@@ -7,8 +7,96 @@
 #define DLLEXPORT
 #endif
 
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+
+/*
+    内置函数的输出(output.cpp) 写入当前线程的缓冲区 缓冲区满、切换输出、flush、
+    parfor/spawn的任务结束以及线程退出时才写出
+    设置当前线程中内置函数的输出 传入nullptr时恢复为默认的输出
+    守护进程中每个程序线程把输出指向自己的客户端
+*/
+extern "C" DLLEXPORT void SetBuiltinOutput(FILE *out);
+// 当前线程的内置函数输出 未设置时为nullptr(即默认的输出) parfor/spawn的任务在工作线程中沿用调用者的输出
+extern "C" DLLEXPORT FILE *GetBuiltinOutput();
+/*
+    设置默认的输出: "stdout"、"stderr"(默认)或文件路径 打开文件失败时返回0
+    也可以用环境变量HOSHINO_OUTPUT指定(--emit-exe生成的程序)
+*/
+extern "C" DLLEXPORT int hoshino_output_open(const char *target);
+// 写出当前线程缓冲的输出 顶层表达式执行完、直接写同一输出之前调用
+extern "C" DLLEXPORT void hoshino_output_flush();
 extern "C" DLLEXPORT double putchard(double x);
 extern "C" DLLEXPORT double tab();
 extern "C" DLLEXPORT double endl();
 extern "C" DLLEXPORT double printNum(double x);
+extern "C" DLLEXPORT double printFloat(double x);
+// 脚本中可以调用: extern flush(); 立即写出当前线程缓冲的输出
+extern "C" DLLEXPORT double flush();
+
+/*
+    def pure函数的memo表(memo.cpp) 由生成的代码调用 表按名字区分
+    JIT中名字为"<JITDylib名>/<函数名>" 守护进程在程序结束时按前缀释放该程序的表
+*/
+// 之后创建的每张表最多缓存的结果数 默认65536
+extern "C" DLLEXPORT void hoshino_memo_set_capacity(size_t entries);
+extern "C" DLLEXPORT void *hoshino_memo_table(const char *name, unsigned arity);
+// 命中时返回1并写入result
+extern "C" DLLEXPORT int hoshino_memo_lookup(void *table, const double *args, double *result);
+extern "C" DLLEXPORT void hoshino_memo_insert(void *table, const double *args, double result);
+// 函数(或它调用的函数)被重新定义后清空缓存的结果
+extern "C" DLLEXPORT void hoshino_memo_clear(const char *name);
+extern "C" DLLEXPORT void hoshino_memo_release(const char *prefix);
+// 打印名字以prefix开头的表的命中/未命中/淘汰次数
+extern "C" DLLEXPORT void hoshino_memo_print_stats(FILE *out, const char *prefix);
+// 脚本中可以调用: extern memoStats(); 打印所有memo表的统计
+extern "C" DLLEXPORT double memoStats();
+
+/*
+    parfor的运行时(parallel.cpp) 由生成的代码调用
+    循环体被提取为函数body 每次处理迭代[begin, end) 第k次迭代的循环变量为start + k*step
+    env中是循环开始时的start、step以及循环体用到的外层变量 partials为该分块的归约变量
+*/
+enum HoshinoReduceOp : int32_t {
+    HOSHINO_REDUCE_ADD = 0,
+    HOSHINO_REDUCE_MUL = 1,
+    HOSHINO_REDUCE_MIN = 2,
+    HOSHINO_REDUCE_MAX = 3,
+};
+typedef void (*hoshino_parfor_body)(double *env, int64_t begin, int64_t end, double *partials);
+// grain小于1时由运行时选择 results传入归约变量在循环前的值 返回时为合并后的值
+extern "C" DLLEXPORT void hoshino_parfor(hoshino_parfor_body body, double *env,
+    double start, double bound, double step, double grain,
+    int32_t reductions, const int32_t *ops, double *results);
+
+/*
+    spawn/await/sync的运行时(spawn.cpp) 由生成的代码调用
+    使用spawn的函数在栈上有一个frame 记录该函数spawn出的还没有完成或还没有被await的任务
+    spawn f(args)在调用者中求值参数 再把任务放入当前线程的work-stealing队列 返回future
+    frame与future只由spawn它们的线程访问 函数返回前隐式地sync
+*/
+// frame的大小 生成的代码在函数入口分配这么多字节(按8字节对齐)
+#define HOSHINO_SPAWN_FRAME_SIZE 32
+// 每个spawn处生成一个thunk 从args中取出参数调用被spawn的函数
+typedef double (*hoshino_spawn_thunk)(const double *args);
+extern "C" DLLEXPORT void hoshino_frame_init(void *frame);
+extern "C" DLLEXPORT void *hoshino_spawn(void *frame, hoshino_spawn_thunk thunk, const double *args, int32_t nargs);
+// 等待该任务完成并返回它的结果 future属于frame时被回收 不能再次await
+extern "C" DLLEXPORT double hoshino_await(void *frame, void *future);
+// 等待frame中所有的任务完成 future保留在frame中 之后仍可以await
+extern "C" DLLEXPORT void hoshino_sync(void *frame);
+// 函数返回前的隐式sync: 等待所有任务完成 并回收没有被await的future
+extern "C" DLLEXPORT void hoshino_frame_release(void *frame);
+
+/*
+    --profile的运行时(profile.cpp) 只有开启--profile时生成的代码才会调用
+    函数按名字编号 重新定义的函数沿用原来的编号 生成的代码把编号缓存在internal的全局变量中
+*/
+extern "C" DLLEXPORT int32_t hoshino_profile_id(const char *name);
+extern "C" DLLEXPORT void hoshino_profile_enter(int32_t id);
+// trips为这次调用中for循环体执行的次数
+extern "C" DLLEXPORT void hoshino_profile_exit(int32_t id, int64_t trips);
+// 按exclusive时间从大到小打印每个函数的调用次数、时间与循环次数 out为nullptr时打印到stderr
+extern "C" DLLEXPORT void hoshino_profile_report(FILE *out);
 #endif
\ No newline at end of file
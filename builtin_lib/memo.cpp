@@ -0,0 +1,157 @@
+#include "lib.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/*
+    def pure函数的memo表
+    每张表是组相联的缓存: 参数的位模式哈希到一个组 组内有memoWays个位置
+    组满时淘汰组内最久未使用的项 因此表的大小是固定的 不会随调用无限增长
+*/
+namespace {
+
+constexpr size_t memoWays = 4;
+
+struct MemoTable {
+    std::string name;
+    unsigned arity;
+    size_t sets;
+    // 第i项的参数位于keys[i*arity, (i+1)*arity) stamps为0表示该项为空
+    std::vector<double> keys;
+    std::vector<double> results;
+    std::vector<uint64_t> stamps;
+    uint64_t clock = 0;
+    uint64_t hits = 0, misses = 0, evictions = 0;
+    // 同一个程序中parfor/spawn的任务可能同时调用pure函数
+    std::mutex mutex;
+
+    MemoTable(std::string name, unsigned arity, size_t capacity)
+        : name(std::move(name)), arity(arity) {
+        sets = 1;
+        while(sets * memoWays < capacity)
+            sets <<= 1;
+        keys.resize(sets * memoWays * arity);
+        results.resize(sets * memoWays);
+        stamps.resize(sets * memoWays);
+    }
+
+    size_t SetOf(const double *args) const {
+        // 整数值的double只有高位不同 用splitmix64的混合函数把高位扩散到低位
+        uint64_t hash = 0x9e3779b97f4a7c15ull;
+        for(unsigned i = 0; i < arity; ++i){
+            uint64_t bits;
+            memcpy(&bits, &args[i], sizeof(bits));
+            hash ^= bits;
+            hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ull;
+            hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebull;
+            hash ^= hash >> 31;
+        }
+        return hash & (sets - 1);
+    }
+
+    bool Matches(size_t index, const double *args) const {
+        return stamps[index] != 0 && memcmp(&keys[index * arity], args, arity * sizeof(double)) == 0;
+    }
+
+    void Clear() {
+        std::fill(stamps.begin(), stamps.end(), 0);
+    }
+};
+
+std::mutex tablesMutex;
+std::map<std::string, std::unique_ptr<MemoTable>> tables;
+size_t memoCapacity = 65536;
+
+} // namespace
+
+extern "C" DLLEXPORT void hoshino_memo_set_capacity(size_t entries){
+    std::lock_guard<std::mutex> lock{tablesMutex};
+    memoCapacity = entries ? entries : 1;
+}
+
+extern "C" DLLEXPORT void *hoshino_memo_table(const char *name, unsigned arity){
+    std::lock_guard<std::mutex> lock{tablesMutex};
+    auto &table = tables[name];
+    if(!table)
+        table = std::make_unique<MemoTable>(name, arity, memoCapacity);
+    return table.get();
+}
+
+extern "C" DLLEXPORT int hoshino_memo_lookup(void *handle, const double *args, double *result){
+    auto *table = static_cast<MemoTable*>(handle);
+    std::lock_guard<std::mutex> lock{table->mutex};
+    size_t first = table->SetOf(args) * memoWays;
+    for(size_t i = first; i < first + memoWays; ++i){
+        if(table->Matches(i, args)){
+            table->stamps[i] = ++table->clock;
+            *result = table->results[i];
+            ++table->hits;
+            return 1;
+        }
+    }
+    ++table->misses;
+    return 0;
+}
+
+extern "C" DLLEXPORT void hoshino_memo_insert(void *handle, const double *args, double result){
+    auto *table = static_cast<MemoTable*>(handle);
+    std::lock_guard<std::mutex> lock{table->mutex};
+    size_t first = table->SetOf(args) * memoWays;
+    // 已有相同的参数(递归调用期间被插入)时覆盖 否则用空位或最久未使用的项
+    size_t victim = first;
+    for(size_t i = first; i < first + memoWays; ++i){
+        if(table->Matches(i, args)){
+            victim = i;
+            break;
+        }
+        if(table->stamps[i] < table->stamps[victim])
+            victim = i;
+    }
+    if(table->stamps[victim] != 0 && !table->Matches(victim, args))
+        ++table->evictions;
+    memcpy(&table->keys[victim * table->arity], args, table->arity * sizeof(double));
+    table->results[victim] = result;
+    table->stamps[victim] = ++table->clock;
+}
+
+extern "C" DLLEXPORT void hoshino_memo_clear(const char *name){
+    std::lock_guard<std::mutex> lock{tablesMutex};
+    if(auto it = tables.find(name); it != tables.end()){
+        std::lock_guard<std::mutex> tableLock{it->second->mutex};
+        it->second->Clear();
+    }
+}
+
+extern "C" DLLEXPORT void hoshino_memo_release(const char *prefix){
+    std::lock_guard<std::mutex> lock{tablesMutex};
+    size_t len = strlen(prefix);
+    for(auto it = tables.begin(); it != tables.end();){
+        if(it->first.compare(0, len, prefix) == 0)
+            it = tables.erase(it);
+        else
+            ++it;
+    }
+}
+
+extern "C" DLLEXPORT void hoshino_memo_print_stats(FILE *out, const char *prefix){
+    std::lock_guard<std::mutex> lock{tablesMutex};
+    size_t len = strlen(prefix);
+    for(auto &[name, table] : tables){
+        if(name.compare(0, len, prefix) != 0)
+            continue;
+        std::lock_guard<std::mutex> tableLock{table->mutex};
+        size_t used = 0;
+        for(auto stamp : table->stamps)
+            used += stamp != 0;
+        uint64_t calls = table->hits + table->misses;
+        fprintf(out, "memo %s: hits=%llu misses=%llu hit-rate=%.1f%% evictions=%llu entries=%zu/%zu\n",
+            name.c_str(), (unsigned long long)table->hits, (unsigned long long)table->misses,
+            calls ? 100.0 * table->hits / calls : 0.0, (unsigned long long)table->evictions,
+            used, table->stamps.size());
+    }
+}
@@ -0,0 +1,145 @@
+#include "lib.h"
+#include "output.h"
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace {
+
+constexpr size_t bufferSize = 8192;
+
+// 默认的输出 nullptr为stderr 启动时可以用环境变量HOSHINO_OUTPUT(stdout|stderr|文件路径)指定
+std::atomic<FILE*> defaultSink{nullptr};
+std::once_flag envOnce;
+std::mutex openMutex;
+// hoshino_output_open打开的文件 在所有线程的缓冲区写出之后(静态对象析构时)关闭
+struct OpenedFile {
+    FILE *file = nullptr;
+    ~OpenedFile(){
+        if(file)
+            fclose(file);
+    }
+} opened;
+
+// target为stdout、stderr或文件路径 打开失败时返回false
+bool SetDefaultSink(const char *target){
+    FILE *sink = nullptr;
+    std::string name{target};
+    if(name == "stdout"){
+        sink = stdout;
+    }else if(name != "stderr"){
+        sink = fopen(target, "w");
+        if(!sink)
+            return false;
+    }
+    std::lock_guard<std::mutex> lock{openMutex};
+    FILE *previous = defaultSink.exchange(sink, std::memory_order_acq_rel);
+    if(previous && previous == opened.file)
+        fclose(previous);
+    opened.file = sink != stdout ? sink : nullptr;
+    return true;
+}
+
+FILE *DefaultSink(){
+    std::call_once(envOnce, []{
+        if(const char *env = std::getenv("HOSHINO_OUTPUT"); env && !SetDefaultSink(env))
+            fprintf(stderr, "Warning: could not open HOSHINO_OUTPUT=%s, writing to stderr\n", env);
+    });
+    FILE *sink = defaultSink.load(std::memory_order_acquire);
+    return sink ? sink : stderr;
+}
+
+struct Buffer {
+    // SetBuiltinOutput设置的输出 nullptr为默认的输出
+    FILE *sink = nullptr;
+    size_t size = 0;
+    // 第一次写入时才分配 没有输出的线程(比如编译线程)不占用内存
+    std::unique_ptr<char[]> data;
+
+    // 线程退出(包括主线程从main返回、调用exit)时写出剩余的内容
+    ~Buffer(){
+        Flush();
+    }
+
+    FILE *Sink() const {
+        return sink ? sink : DefaultSink();
+    }
+
+    void Flush(){
+        if(size == 0)
+            return;
+        FILE *out = Sink();
+        fwrite(data.get(), 1, size, out);
+        fflush(out);
+        size = 0;
+    }
+
+    void Write(const char *str, size_t n){
+        if(size + n > bufferSize){
+            Flush();
+            // 比缓冲区还大的内容直接写出
+            if(n > bufferSize){
+                fwrite(str, 1, n, Sink());
+                return;
+            }
+        }
+        if(!data)
+            data = std::make_unique<char[]>(bufferSize);
+        memcpy(data.get() + size, str, n);
+        size += n;
+    }
+};
+
+thread_local Buffer buffer;
+
+} // namespace
+
+namespace hoshino::output {
+
+void Write(const char *data, size_t size){
+    buffer.Write(data, size);
+}
+
+void Put(char c){
+    buffer.Write(&c, 1);
+}
+
+void Flush(){
+    buffer.Flush();
+}
+
+FILE *Sink(){
+    return buffer.Sink();
+}
+
+}
+
+extern "C" DLLEXPORT void SetBuiltinOutput(FILE *out){
+    // 之前缓冲的内容属于原来的输出
+    if(buffer.sink != out)
+        buffer.Flush();
+    buffer.sink = out;
+}
+
+extern "C" DLLEXPORT FILE *GetBuiltinOutput(){
+    return buffer.sink;
+}
+
+extern "C" DLLEXPORT int hoshino_output_open(const char *target){
+    // 之前缓冲的内容写到原来的输出 (也使HOSHINO_OUTPUT先生效 之后不会再覆盖这里的设置)
+    buffer.Flush();
+    DefaultSink();
+    return SetDefaultSink(target);
+}
+
+extern "C" DLLEXPORT void hoshino_output_flush(){
+    buffer.Flush();
+}
+
+extern "C" DLLEXPORT double flush(){
+    buffer.Flush();
+    return 0;
+}
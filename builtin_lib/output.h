@@ -0,0 +1,24 @@
+#ifndef HOSHINO_OUTPUT_H
+#define HOSHINO_OUTPUT_H
+
+#include <cstddef>
+#include <cstdio>
+
+/*
+    builtin_lib内部使用的输出缓冲 (putchard、printNum等内置函数的输出)
+    每个线程有自己的缓冲区 写入时不加锁 缓冲区满、切换输出、显式flush以及线程退出时
+    才用一次fwrite写到输出 stdio对同一FILE的fwrite是互斥的 所以各线程的输出不会交错在一个字符中间
+    线程的输出为SetBuiltinOutput设置的FILE 未设置时为默认的输出(默认stderr)
+*/
+namespace hoshino::output {
+
+void Write(const char *data, size_t size);
+void Put(char c);
+// 把当前线程缓冲的内容写到输出
+void Flush();
+// 当前线程的输出 之后直接写这个FILE之前应先Flush
+FILE *Sink();
+
+}
+
+#endif
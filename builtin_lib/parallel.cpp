@@ -0,0 +1,123 @@
+#include "lib.h"
+#include "scheduler.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+using namespace hoshino::sched;
+
+/*
+    parfor的运行时: 迭代按grain分块 分块区间由调用者递归二分
+    一半push到自己的队列供其他线程窃取 另一半继续二分 直到只剩一个分块时执行
+    每个分块的归约结果写在自己的位置 全部完成后按分块顺序合并 结果与线程数无关
+*/
+namespace {
+
+struct ParforJob {
+    hoshino_parfor_body body;
+    double *env;
+    int64_t iterations;
+    int64_t grain;
+    int32_t reductions;
+    std::vector<double> partials;
+    std::atomic<int64_t> remaining;
+    FILE *output;
+};
+
+struct RangeTask : Task {
+    ParforJob *job;
+    int64_t first, last;
+};
+
+void RunRange(ParforJob *job, int64_t first, int64_t last);
+
+void RunRangeTask(Task *task){
+    auto *range = static_cast<RangeTask*>(task);
+    ParforJob *job = range->job;
+    int64_t first = range->first, last = range->last;
+    delete range;
+    RunRange(job, first, last);
+}
+
+void RunRange(ParforJob *job, int64_t first, int64_t last){
+    while(last - first > 1){
+        int64_t mid = first + (last - first) / 2;
+        auto *half = new RangeTask;
+        half->run = RunRangeTask;
+        half->output = job->output;
+        half->job = job;
+        half->first = mid;
+        half->last = last;
+        if(!Push(half)){
+            // 队列已满 剩下的分块在本线程依次执行
+            delete half;
+            break;
+        }
+        last = mid;
+    }
+    for(int64_t chunk = first; chunk < last; ++chunk){
+        int64_t begin = chunk * job->grain;
+        int64_t end = std::min(begin + job->grain, job->iterations);
+        job->body(job->env, begin, end, job->partials.data() + chunk * job->reductions);
+    }
+    job->remaining.fetch_sub(last - first, std::memory_order_acq_rel);
+}
+
+double Combine(int32_t op, double lhs, double rhs){
+    switch(op){
+    case HOSHINO_REDUCE_MUL: return lhs * rhs;
+    case HOSHINO_REDUCE_MIN: return std::min(lhs, rhs);
+    case HOSHINO_REDUCE_MAX: return std::max(lhs, rhs);
+    default: return lhs + rhs;
+    }
+}
+
+// 每个分块的归约变量从单位元开始
+double Identity(int32_t op){
+    switch(op){
+    case HOSHINO_REDUCE_MUL: return 1;
+    case HOSHINO_REDUCE_MIN: return std::numeric_limits<double>::infinity();
+    case HOSHINO_REDUCE_MAX: return -std::numeric_limits<double>::infinity();
+    default: return 0;
+    }
+}
+
+} // namespace
+
+extern "C" DLLEXPORT void hoshino_parfor(hoshino_parfor_body body, double *env,
+    double start, double bound, double step, double grain,
+    int32_t reductions, const int32_t *ops, double *results){
+    // 迭代次数与顺序的for i = start; i < bound; i = i + step相同 步长不为正时不执行
+    if(!(step > 0) || !(bound > start))
+        return;
+    double count = std::ceil((bound - start) / step);
+    if(!(count >= 1))
+        return;
+    int64_t iterations = static_cast<int64_t>(count);
+    ParforJob job;
+    job.body = body;
+    job.env = env;
+    job.iterations = iterations;
+    // 没有指定grain时每个线程大约分到8个分块
+    job.grain = grain >= 1 ? static_cast<int64_t>(grain)
+        : std::max<int64_t>(1, iterations / (8 * (WorkerCount() + 1)));
+    job.reductions = reductions;
+    int64_t chunks = (iterations + job.grain - 1) / job.grain;
+    job.partials.assign(chunks * reductions, 0);
+    for(int64_t chunk = 0; chunk < chunks; ++chunk)
+        for(int32_t r = 0; r < reductions; ++r)
+            job.partials[chunk * reductions + r] = Identity(ops[r]);
+    job.remaining.store(chunks);
+    job.output = GetBuiltinOutput();
+    RunRange(&job, 0, chunks);
+    HelpUntil(job.remaining);
+    for(int32_t r = 0; r < reductions; ++r){
+        double acc = Identity(ops[r]);
+        for(int64_t chunk = 0; chunk < chunks; ++chunk)
+            acc = Combine(ops[r], acc, job.partials[chunk * reductions + r]);
+        results[r] = Combine(ops[r], results[r], acc);
+    }
+}
@@ -0,0 +1,155 @@
+#include "lib.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+    --profile的运行时: 生成的代码在函数入口调用hoshino_profile_enter 每个ret之前调用hoshino_profile_exit
+    每个线程有自己的计数器与调用栈 只有报告时才需要加锁汇总
+    inclusive: 从进入到返回的时间 递归调用只计最外层的一次
+    exclusive: inclusive减去其中调用其他函数(以及在await/sync中帮忙执行其他任务)的时间
+*/
+namespace {
+
+// 计数器由所属线程写入 报告时由其他线程读取 使用relaxed的load+store 不需要原子的读-改-写
+struct Counter {
+    std::atomic<uint64_t> calls{0};
+    std::atomic<int64_t> inclusive{0};
+    std::atomic<int64_t> exclusive{0};
+    std::atomic<uint64_t> trips{0};
+    // 当前线程中该函数正在执行的层数 只由所属线程访问
+    unsigned active = 0;
+};
+
+void Add(std::atomic<uint64_t> &counter, uint64_t value){
+    counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+void Add(std::atomic<int64_t> &counter, int64_t value){
+    counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+struct Frame {
+    int32_t id;
+    int64_t start;
+    int64_t children;
+};
+
+// std::deque在末尾增长时不移动已有的元素 报告时可以与所属线程同时访问已有的计数器
+struct ThreadProfile {
+    std::mutex mutex;
+    std::deque<Counter> counters;
+    std::vector<Frame> stack;
+
+    Counter &Get(int32_t id){
+        if(static_cast<size_t>(id) >= counters.size()){
+            std::lock_guard<std::mutex> lock{mutex};
+            counters.resize(id + 1);
+        }
+        return counters[id];
+    }
+};
+
+// 线程退出后它的计数器仍要出现在报告中 所以都不释放
+std::mutex registryMutex;
+std::unordered_map<std::string, int32_t> &ids = *new std::unordered_map<std::string, int32_t>;
+std::vector<std::string> &names = *new std::vector<std::string>;
+std::vector<ThreadProfile*> &threads = *new std::vector<ThreadProfile*>;
+
+ThreadProfile &Local(){
+    static thread_local ThreadProfile *local = nullptr;
+    if(!local){
+        local = new ThreadProfile;
+        std::lock_guard<std::mutex> lock{registryMutex};
+        threads.push_back(local);
+    }
+    return *local;
+}
+
+int64_t Now(){
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+} // namespace
+
+extern "C" DLLEXPORT int32_t hoshino_profile_id(const char *name){
+    std::lock_guard<std::mutex> lock{registryMutex};
+    auto [it, inserted] = ids.try_emplace(name, static_cast<int32_t>(names.size()));
+    if(inserted)
+        names.push_back(name);
+    return it->second;
+}
+
+extern "C" DLLEXPORT void hoshino_profile_enter(int32_t id){
+    auto &profile = Local();
+    ++profile.Get(id).active;
+    profile.stack.push_back({id, Now(), 0});
+}
+
+extern "C" DLLEXPORT void hoshino_profile_exit(int32_t id, int64_t trips){
+    int64_t now = Now();
+    auto &profile = Local();
+    if(profile.stack.empty())
+        return;
+    Frame frame = profile.stack.back();
+    profile.stack.pop_back();
+    int64_t elapsed = now - frame.start;
+    auto &counter = profile.Get(frame.id);
+    Add(counter.calls, 1);
+    Add(counter.exclusive, elapsed - frame.children);
+    Add(counter.trips, trips);
+    if(--counter.active == 0)
+        Add(counter.inclusive, elapsed);
+    if(!profile.stack.empty())
+        profile.stack.back().children += elapsed;
+}
+
+extern "C" DLLEXPORT void hoshino_profile_report(FILE *out){
+    if(!out)
+        out = stderr;
+    struct Row {
+        std::string name;
+        uint64_t calls = 0, trips = 0;
+        int64_t inclusive = 0, exclusive = 0;
+    };
+    std::vector<Row> rows;
+    {
+        std::lock_guard<std::mutex> lock{registryMutex};
+        rows.resize(names.size());
+        for(size_t id = 0; id < names.size(); ++id)
+            rows[id].name = names[id];
+        for(auto *thread : threads){
+            std::lock_guard<std::mutex> threadLock{thread->mutex};
+            for(size_t id = 0; id < thread->counters.size() && id < rows.size(); ++id){
+                auto &counter = thread->counters[id];
+                rows[id].calls += counter.calls.load(std::memory_order_relaxed);
+                rows[id].trips += counter.trips.load(std::memory_order_relaxed);
+                rows[id].inclusive += counter.inclusive.load(std::memory_order_relaxed);
+                rows[id].exclusive += counter.exclusive.load(std::memory_order_relaxed);
+            }
+        }
+    }
+    rows.erase(std::remove_if(rows.begin(), rows.end(), [](const Row &row){ return row.calls == 0; }),
+        rows.end());
+    std::sort(rows.begin(), rows.end(), [](const Row &lhs, const Row &rhs){
+        return lhs.exclusive > rhs.exclusive;
+    });
+    int64_t total = 0;
+    for(auto &row : rows)
+        total += row.exclusive;
+    fprintf(out, "===== profile =====\n");
+    fprintf(out, "%-24s %12s %12s %12s %7s %14s\n", "function", "calls", "incl(ms)", "excl(ms)", "excl%", "loop trips");
+    for(auto &row : rows)
+        fprintf(out, "%-24s %12llu %12.3f %12.3f %6.1f%% %14llu\n", row.name.c_str(),
+            (unsigned long long)row.calls, row.inclusive * 1e-6, row.exclusive * 1e-6,
+            total > 0 ? 100.0 * row.exclusive / total : 0.0, (unsigned long long)row.trips);
+    fflush(out);
+}
@@ -0,0 +1,244 @@
+#include "scheduler.h"
+#include "lib.h"
+#include <chrono>
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace hoshino::sched {
+
+namespace {
+
+/*
+    Chase-Lev双端队列 (按"Correct and Efficient Work-Stealing for Weak Memory Models"的写法)
+    容量固定 满了由调用者直接执行任务 fork-join的语义不受影响
+*/
+class Deque {
+    static constexpr int64_t capacity = 1 << 13;
+    static constexpr int64_t mask = capacity - 1;
+    alignas(64) std::atomic<int64_t> top{0};
+    alignas(64) std::atomic<int64_t> bottom{0};
+    std::atomic<Task*> buffer[capacity];
+public:
+    // 该队列是否属于某个仍在运行的线程 线程退出后队列留给之后的线程复用 不会被释放
+    std::atomic<bool> owned{false};
+
+    bool Push(Task *task){
+        int64_t b = bottom.load(std::memory_order_relaxed);
+        int64_t t = top.load(std::memory_order_acquire);
+        if(b - t >= capacity)
+            return false;
+        buffer[b & mask].store(task, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom.store(b + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    Task *Pop(){
+        int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top.load(std::memory_order_relaxed);
+        if(t > b){
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        Task *task = buffer[b & mask].load(std::memory_order_relaxed);
+        if(t == b){
+            // 最后一个任务 与窃取者竞争
+            if(!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                task = nullptr;
+            bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return task;
+    }
+
+    Task *Steal(){
+        int64_t t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = bottom.load(std::memory_order_acquire);
+        if(t >= b)
+            return nullptr;
+        Task *task = buffer[t & mask].load(std::memory_order_relaxed);
+        if(!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            return nullptr;
+        return task;
+    }
+};
+
+constexpr int maxDeques = 256;
+std::atomic<Deque*> deques[maxDeques];
+std::atomic<int> dequeCount{0};
+
+/*
+    休眠的工作线程 push时如果有休眠的线程就唤醒一个
+    工作线程是detach的 进程退出时可能仍在等待 所以互斥量与条件变量不析构
+*/
+struct SleepState {
+    std::mutex mutex;
+    std::condition_variable cv;
+};
+SleepState &sleepState = *new SleepState;
+std::atomic<int> sleepers{0};
+std::atomic<uint64_t> epoch{0};
+
+// 为当前线程取得一个队列: 优先复用已退出线程留下的队列
+Deque *AcquireDeque(){
+    int count = dequeCount.load(std::memory_order_acquire);
+    for(int i = 0; i < count; ++i){
+        Deque *deque = deques[i].load(std::memory_order_acquire);
+        bool expected = false;
+        if(deque && deque->owned.compare_exchange_strong(expected, true))
+            return deque;
+    }
+    auto *deque = new Deque;
+    deque->owned.store(true);
+    int index = dequeCount.fetch_add(1);
+    if(index >= maxDeques){
+        // 线程过多 该线程的任务只在本线程执行(Push总是失败)
+        dequeCount.fetch_sub(1);
+        delete deque;
+        return nullptr;
+    }
+    deques[index].store(deque, std::memory_order_release);
+    return deque;
+}
+
+struct LocalDeque {
+    Deque *deque = AcquireDeque();
+    ~LocalDeque(){
+        if(deque)
+            deque->owned.store(false);
+    }
+};
+
+Deque *Local(){
+    static thread_local LocalDeque local;
+    return local.deque;
+}
+
+Task *StealAny(unsigned &seed){
+    int count = dequeCount.load(std::memory_order_acquire);
+    if(count == 0)
+        return nullptr;
+    // xorshift选择起始位置 避免所有线程按同样的顺序窃取
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    int start = seed % count;
+    Deque *self = Local();
+    for(int i = 0; i < count; ++i){
+        Deque *victim = deques[(start + i) % count].load(std::memory_order_acquire);
+        if(!victim || victim == self)
+            continue;
+        if(Task *task = victim->Steal())
+            return task;
+    }
+    return nullptr;
+}
+
+void WorkerLoop(unsigned id){
+    unsigned seed = id * 2654435761u + 1;
+    while(true){
+        Task *task = Pop();
+        if(!task)
+            task = StealAny(seed);
+        if(task){
+            Run(task);
+            continue;
+        }
+        // 没有任务: 记下epoch后再尝试一次 仍然没有就休眠到有新的push
+        uint64_t seen = epoch.load(std::memory_order_acquire);
+        if((task = StealAny(seed))){
+            Run(task);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock{sleepState.mutex};
+        sleepers.fetch_add(1);
+        sleepState.cv.wait_for(lock, std::chrono::milliseconds(10), [&]{
+            return epoch.load(std::memory_order_acquire) != seen;
+        });
+        sleepers.fetch_sub(1);
+    }
+}
+
+/*
+    HOSHINO_THREADS为执行parfor/spawn的总线程数(至少为1) 默认为CPU核数
+    调用parfor/spawn的线程自己也参与执行 所以只启动N-1个工作线程 N为1时所有任务都在调用者中执行
+*/
+unsigned StartWorkers(){
+    unsigned threads = std::max(std::thread::hardware_concurrency(), 1u);
+    if(const char *env = std::getenv("HOSHINO_THREADS")){
+        char *end = nullptr;
+        errno = 0;
+        unsigned long value = std::strtoul(env, &end, 10);
+        if(end == env || *end != '\0' || errno || value == 0 || value > UINT_MAX || *env == '-')
+            fprintf(stderr, "Warning: invalid HOSHINO_THREADS=%s (expected a thread count >= 1), using %u\n",
+                env, threads);
+        else
+            threads = value;
+    }
+    unsigned count = threads - 1;
+    for(unsigned i = 0; i < count; ++i)
+        std::thread{WorkerLoop, i + 1}.detach();
+    return count;
+}
+
+} // namespace
+
+unsigned WorkerCount(){
+    static unsigned count = StartWorkers();
+    return count;
+}
+
+bool Push(Task *task){
+    WorkerCount();
+    Deque *deque = Local();
+    if(!deque || !deque->Push(task))
+        return false;
+    epoch.fetch_add(1, std::memory_order_release);
+    if(sleepers.load(std::memory_order_relaxed) > 0){
+        std::lock_guard<std::mutex> lock{sleepState.mutex};
+        sleepState.cv.notify_one();
+    }
+    return true;
+}
+
+Task *Pop(){
+    Deque *deque = Local();
+    return deque ? deque->Pop() : nullptr;
+}
+
+void HelpUntil(const std::atomic<int64_t> &remaining){
+    static thread_local unsigned seed = static_cast<unsigned>(
+        std::hash<std::thread::id>{}(std::this_thread::get_id())) | 1;
+    int idle = 0;
+    while(remaining.load(std::memory_order_acquire) > 0){
+        Task *task = Pop();
+        if(!task)
+            task = StealAny(seed);
+        if(task){
+            Run(task);
+            idle = 0;
+        }else if(++idle > 64){
+            std::this_thread::yield();
+        }
+    }
+}
+
+void Run(Task *task){
+    FILE *saved = GetBuiltinOutput();
+    SetBuiltinOutput(task->output);
+    task->run(task);
+    // 任务的输出不留在工作线程的缓冲区中 等待它的线程返回后就能看到
+    hoshino_output_flush();
+    SetBuiltinOutput(saved);
+}
+
+}
@@ -0,0 +1,45 @@
+#ifndef HOSHINO_SCHEDULER_H
+#define HOSHINO_SCHEDULER_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+
+/*
+    builtin_lib内部使用的work-stealing调度器 (parfor与spawn/sync的运行时)
+    每个参与调度的线程(工作线程以及调用parfor/spawn的线程)有一个Chase-Lev双端队列:
+    所有者在底部push/pop 其他线程从顶部steal 队列操作都是无锁的
+    空闲的工作线程在条件变量上休眠 有新任务时被唤醒
+*/
+namespace hoshino::sched {
+
+struct Task {
+    void (*run)(Task *task) = nullptr;
+    // 执行任务时内置函数的输出 (守护进程中为提交脚本的客户端)
+    FILE *output = nullptr;
+};
+
+// 工作线程的数量(不含调用者) 第一次使用时启动 环境变量HOSHINO_THREADS指定包括调用者在内的总线程数
+unsigned WorkerCount();
+
+/*
+    把任务放入当前线程的队列 其他线程可以窃取
+    队列已满时返回false 调用者应当直接执行该任务
+*/
+bool Push(Task *task);
+
+// 从当前线程的队列底部取回最近push的任务 队列为空(或已被窃取)时返回nullptr
+Task *Pop();
+
+/*
+    在等待的条件满足之前帮助执行其他任务: 先取自己队列中的任务 再从其他线程窃取
+    parfor等待所有分块完成、sync等待子任务完成时使用 因此嵌套的并行不会死锁
+*/
+void HelpUntil(const std::atomic<int64_t> &remaining);
+
+// 执行一个任务 期间把内置函数的输出切换为任务的输出
+void Run(Task *task);
+
+}
+
+#endif
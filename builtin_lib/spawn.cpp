@@ -0,0 +1,153 @@
+#include "lib.h"
+#include "scheduler.h"
+#include <atomic>
+#include <cstring>
+#include <new>
+
+using namespace hoshino::sched;
+
+/*
+    spawn/await/sync: 被spawn的调用作为任务放入当前线程的队列 调用者继续执行(子任务可以被窃取)
+    await与sync在等待时先执行自己队列中的任务 没有被窃取的子任务因此直接在调用者中执行
+    future从线程的空闲链表分配 递归地spawn到很细的粒度时不需要每次都调用malloc
+*/
+namespace {
+
+struct Frame;
+
+struct Future : Task {
+    hoshino_spawn_thunk thunk;
+    // 参数不超过inlineArgs的个数时放在future中 否则另外分配
+    double *args;
+    double inlineArgs[6];
+    int32_t nargs;
+    double result;
+    // 任务完成时变为0
+    std::atomic<int64_t> remaining;
+    Frame *frame;
+    // frame中还没有被await的future组成的双向链表
+    Future *prev, *next;
+};
+
+struct Frame {
+    // 还没有完成的任务数
+    std::atomic<int64_t> pending;
+    Future *head;
+};
+static_assert(sizeof(Frame) <= HOSHINO_SPAWN_FRAME_SIZE && alignof(Frame) <= 8,
+    "generated code reserves HOSHINO_SPAWN_FRAME_SIZE bytes for a frame");
+
+// 每个线程回收的future 只由该线程分配和释放
+struct FuturePool {
+    static constexpr int maxFree = 1024;
+    Future *free = nullptr;
+    int count = 0;
+
+    Future *Allocate(){
+        if(Future *future = free){
+            free = future->next;
+            --count;
+            return future;
+        }
+        return new Future;
+    }
+
+    void Release(Future *future){
+        if(future->args != future->inlineArgs)
+            delete[] future->args;
+        if(count >= maxFree){
+            delete future;
+            return;
+        }
+        future->next = free;
+        free = future;
+        ++count;
+    }
+
+    ~FuturePool(){
+        while(free){
+            Future *next = free->next;
+            delete free;
+            free = next;
+        }
+    }
+};
+
+FuturePool &Pool(){
+    static thread_local FuturePool pool;
+    return pool;
+}
+
+void RunFuture(Task *task){
+    auto *future = static_cast<Future*>(task);
+    future->result = future->thunk(future->args);
+    // 先取出frame: remaining变为0后future可能被await回收
+    Frame *frame = future->frame;
+    future->remaining.store(0, std::memory_order_release);
+    frame->pending.fetch_sub(1, std::memory_order_acq_rel);
+}
+
+void Unlink(Frame *frame, Future *future){
+    if(future->prev)
+        future->prev->next = future->next;
+    else
+        frame->head = future->next;
+    if(future->next)
+        future->next->prev = future->prev;
+}
+
+} // namespace
+
+extern "C" DLLEXPORT void hoshino_frame_init(void *frame){
+    new (frame) Frame{{0}, nullptr};
+}
+
+extern "C" DLLEXPORT void *hoshino_spawn(void *handle, hoshino_spawn_thunk thunk, const double *args, int32_t nargs){
+    auto *frame = static_cast<Frame*>(handle);
+    Future *future = Pool().Allocate();
+    future->run = RunFuture;
+    future->output = GetBuiltinOutput();
+    future->thunk = thunk;
+    future->args = nargs <= 6 ? future->inlineArgs : new double[nargs];
+    memcpy(future->args, args, nargs * sizeof(double));
+    future->nargs = nargs;
+    future->remaining.store(1, std::memory_order_relaxed);
+    future->frame = frame;
+    future->prev = nullptr;
+    future->next = frame->head;
+    if(frame->head)
+        frame->head->prev = future;
+    frame->head = future;
+    frame->pending.fetch_add(1, std::memory_order_relaxed);
+    // 队列已满时直接执行
+    if(!Push(future))
+        RunFuture(future);
+    return future;
+}
+
+extern "C" DLLEXPORT double hoshino_await(void *handle, void *pointer){
+    auto *frame = static_cast<Frame*>(handle);
+    auto *future = static_cast<Future*>(pointer);
+    HelpUntil(future->remaining);
+    double result = future->result;
+    // 句柄被传给了其他函数: future仍链在spawn它的函数的frame中 由那个函数返回时回收
+    if(future->frame == frame){
+        Unlink(frame, future);
+        Pool().Release(future);
+    }
+    return result;
+}
+
+extern "C" DLLEXPORT void hoshino_sync(void *handle){
+    auto *frame = static_cast<Frame*>(handle);
+    HelpUntil(frame->pending);
+}
+
+extern "C" DLLEXPORT void hoshino_frame_release(void *handle){
+    auto *frame = static_cast<Frame*>(handle);
+    HelpUntil(frame->pending);
+    while(Future *future = frame->head){
+        frame->head = future->next;
+        Pool().Release(future);
+    }
+}
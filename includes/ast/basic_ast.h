@@ -5,13 +5,16 @@
 #include <llvm/IR/Function.h>
 #include <llvm/IR/Value.h>
 #include <memory>
+#include <set>
 #include <string>
 #include <string_view>
 #include <utility>
 #include <vector>
+#include "tools/mem_report.h"
 
 
 namespace hoshino {
+class ExprAST;
 class NumberExprAST;
 class StrExprAST;
 class VariableExprAST;
@@ -22,6 +25,10 @@ class BlockExprAST;
 class CallExprAST;
 class IfExprAST;
 class ForExprAST;
+class ParforExprAST;
+class SpawnExprAST;
+class AwaitExprAST;
+class SyncExprAST;
 class PrototypeAST;
 class FunctionAST;
 
@@ -38,6 +45,10 @@ public:
     virtual llvm::Value* CodeGen(CallExprAST*) = 0;
     virtual llvm::Value* CodeGen(IfExprAST*) = 0;
     virtual llvm::Value* CodeGen(ForExprAST*) = 0;
+    virtual llvm::Value* CodeGen(ParforExprAST*) = 0;
+    virtual llvm::Value* CodeGen(SpawnExprAST*) = 0;
+    virtual llvm::Value* CodeGen(AwaitExprAST*) = 0;
+    virtual llvm::Value* CodeGen(SyncExprAST*) = 0;
     virtual llvm::Function* CodeGen(PrototypeAST*) = 0;
     virtual llvm::Function* CodeGen(FunctionAST*) = 0;
     
@@ -56,12 +67,44 @@ public:
     auto CodeGen(CallExprAST *ast) -> llvm::Value* override;
     auto CodeGen(IfExprAST*ast) -> llvm::Value* override;
     auto CodeGen(ForExprAST*ast) -> llvm::Value* override;
+    auto CodeGen(ParforExprAST*ast) -> llvm::Value* override;
+    auto CodeGen(SpawnExprAST*ast) -> llvm::Value* override;
+    auto CodeGen(AwaitExprAST*ast) -> llvm::Value* override;
+    auto CodeGen(SyncExprAST*ast) -> llvm::Value* override;
     auto CodeGen(PrototypeAST *ast) -> llvm::Function* override;
     auto CodeGen(FunctionAST *ast) -> llvm::Function* override;
     ~CodeGenVisitor() = default;
+private:
+    /*
+        当前生成的表达式是否处于尾位置(它的值直接作为函数的返回值)
+        函数体的最后一个表达式、尾位置上if的两个分支、尾位置上block的最后一个表达式处于尾位置
+        其余表达式的子表达式都不在尾位置 尾位置上的调用会被标记为tail
+    */
+    bool tailPosition_ = false;
+    // parfor循环体中以值捕获的外层变量与循环变量的alloca 各分块有自己的副本 不能赋值
+    std::set<llvm::Value*> parforReadOnly_;
+    // 已生成的parfor循环体函数个数 用于给提取出的函数命名
+    unsigned parforCount_ = 0;
+    // 当前函数的spawn frame 函数中第一次使用spawn/await/sync时在入口处创建
+    llvm::Value *spawnFrame_ = nullptr;
+    unsigned spawnCount_ = 0;
+    auto GetSpawnFrame() -> llvm::Value*;
+    // 函数返回前等待所有spawn出的任务并回收它们的future
+    void EmitImplicitSync();
+    /*
+        --profile: 当前函数的编号与记录for循环次数的计数器 未开启--profile时都为nullptr
+        parfor循环体是单独的函数 其中的for循环不计入外层函数
+    */
+    llvm::Value *profileId_ = nullptr;
+    llvm::Value *profileTrips_ = nullptr;
+    void EmitProfileEnter(llvm::Function *theFunc, const std::string &name);
+    // 在theFunc的每个ret之前报告这次调用结束
+    void EmitProfileExits(llvm::Function *theFunc);
+    // 调用带类型标注的extern: 把double的实参转换为参数类型 返回值再转换回double
+    auto EmitNativeArgument(ExprAST *arg, llvm::Type *type) -> llvm::Value*;
 };
 
-class ExprAST{
+class ExprAST : public CountedAST {
 public:
     virtual ~ExprAST() = default;
     virtual llvm::Value* ToLLvmValue(Visitor*) = 0;
@@ -174,13 +217,105 @@ public:
 };
 
 
+/*
+    parfor i = start; i < bound; step grain g reduce op var ... { body }
+    迭代之间相互独立 分块后由builtin_lib中的work-stealing线程池并行执行
+    step为每次迭代的增量(省略时为1) reduce的op为+ * min max
+*/
+class ParforExprAST : public ExprAST {
+    friend class CodeGenVisitor;
+    std::string varName_;
+    std::unique_ptr<ExprAST>start_, bound_, step_, grain_;
+    // (运算符, 变量名)
+    std::vector<std::pair<std::string, std::string>>reductions_;
+    std::unique_ptr<ExprAST>body_;
+public:
+    ParforExprAST(const std::string&varName, 
+    std::unique_ptr<ExprAST>start, std::unique_ptr<ExprAST>bound, 
+    std::unique_ptr<ExprAST>step, std::unique_ptr<ExprAST>grain,
+    std::vector<std::pair<std::string, std::string>>reductions,
+    std::unique_ptr<ExprAST>body) : 
+    varName_(varName), start_(std::move(start)), bound_(std::move(bound)), 
+    step_(std::move(step)), grain_(std::move(grain)), 
+    reductions_(std::move(reductions)), body_(std::move(body)) {}
+    llvm::Value* ToLLvmValue(Visitor*v) override{
+        return v->CodeGen(this);
+    }
+};
+
+/*
+    spawn f(args) 参数在当前线程求值 调用f作为任务交给work-stealing调度器 
+    返回任务的句柄(future) 用await取得结果
+*/
+class SpawnExprAST : public ExprAST {
+    friend class CodeGenVisitor;
+    std::unique_ptr<CallExprAST>call_;
+public:
+    explicit SpawnExprAST(std::unique_ptr<CallExprAST>call) : call_(std::move(call)) {}
+    llvm::Value* ToLLvmValue(Visitor*v) override{
+        return v->CodeGen(this);
+    }
+};
+
+// await handle 等待spawn出的任务完成 返回它的结果 每个句柄只能await一次
+class AwaitExprAST : public ExprAST {
+    friend class CodeGenVisitor;
+    std::unique_ptr<ExprAST>handle_;
+public:
+    explicit AwaitExprAST(std::unique_ptr<ExprAST>handle) : handle_(std::move(handle)) {}
+    llvm::Value* ToLLvmValue(Visitor*v) override{
+        return v->CodeGen(this);
+    }
+};
+
+// sync 等待当前函数spawn出的所有任务 之后这些句柄不能再await 函数返回前隐式地sync
+class SyncExprAST : public ExprAST {
+public:
+    llvm::Value* ToLLvmValue(Visitor*v) override{
+        return v->CodeGen(this);
+    }
+};
+
 // 函数原型 包含函数名称以及参数名称
-class PrototypeAST {
+/*
+    extern参数与返回值的C类型 extern f(n: i32 p: ptr) -> void;
+    没有标注的参数与返回值为f64 hoshino中的值都是double 调用时按类型转换
+    ptr以地址的数值保存在double中(用户空间的地址小于2^53 可以精确表示) 0为空指针
+*/
+enum class NativeType {
+    F64,
+    F32,
+    I32,
+    I64,
+    Ptr,
+    Void,
+};
+
+// 类型名 -> NativeType 不是类型名时返回false
+inline bool ParseNativeType(std::string_view name, NativeType &type){
+    static const std::pair<std::string_view, NativeType> names[] = {
+        {"f64", NativeType::F64}, {"f32", NativeType::F32}, {"i32", NativeType::I32},
+        {"i64", NativeType::I64}, {"ptr", NativeType::Ptr}, {"void", NativeType::Void},
+    };
+    for(auto &[typeName, nativeType] : names)
+        if(typeName == name){
+            type = nativeType;
+            return true;
+        }
+    return false;
+}
+
+class PrototypeAST : public CountedAST {
     friend class CodeGenVisitor;
     std::string name_;
     std::vector<std::string>args_name_;
     bool isOperator_;
     unsigned precedence_;
+    // def pure定义的函数 调用结果缓存在运行时的memo表中
+    bool isPure_ = false;
+    // extern的参数与返回值类型 参数类型为空时全部是f64
+    std::vector<NativeType> args_type_;
+    NativeType return_type_ = NativeType::F64;
 public:
     PrototypeAST(const std::string&name, 
     std::vector<std::string>&&args_name,
@@ -207,16 +342,24 @@ public:
     unsigned GetBinaryPrecedence() const {
         return precedence_;
     }
+    bool isPure() const { return isPure_; }
+    void SetPure(bool isPure) { isPure_ = isPure; }
+    void SetNativeTypes(std::vector<NativeType> &&argsType, NativeType returnType){
+        args_type_ = std::move(argsType);
+        return_type_ = returnType;
+    }
 };
 
 // 函数ast 包含一个函数原型以及函数体
-class FunctionAST {
+class FunctionAST : public CountedAST {
     friend class CodeGenVisitor;
     std::unique_ptr<PrototypeAST>proto_;
     std::unique_ptr<ExprAST>body_;
 public:
     FunctionAST(std::unique_ptr<PrototypeAST>proto, 
     std::unique_ptr<ExprAST>body) : proto_(std::move(proto)), body_(std::move(body)){}
+    // 生成代码之后原型被移入functionProtos 只能在CodeGen之前调用
+    std::string_view GetFuncName() const { return proto_->GetFuncName(); }
     llvm::Function* ToLLvmValue(Visitor*v)  {
         return v->CodeGen(this);
     }
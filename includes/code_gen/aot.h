@@ -0,0 +1,25 @@
+#pragma once
+#include <string>
+#include <vector>
+
+/*
+    AOT(ahead-of-time)编译 对应--emit-obj/--emit-exe
+    与JIT模式使用相同的parser与CodeGenVisitor 但整个源文件的代码都生成到同一个module中
+    顶层表达式仍然生成为匿名函数 最后生成一个main函数按出现顺序依次调用它们
+    生成的object只依赖builtin_lib 运行时不需要初始化llvm与JIT
+*/
+
+// 初始化本机目标并创建TargetMachine(theTargetMachine) 之后的module使用其DataLayout
+extern bool InitAOTTarget();
+
+// 记录一个顶层表达式生成的匿名函数 生成main时按记录顺序调用
+extern void AddAOTTopLevelExpr(const std::string&anonFuncName);
+
+// 记录import的本地库 --emit-exe时与builtin_lib一起链接 库不存在时返回false并设置error
+extern bool AddAOTLibrary(const std::string&path, std::string&error);
+
+/*
+    生成main函数 优化theModule并写出object文件
+    exe模式下再调用系统的c编译器驱动将object与builtin_lib链接为可执行文件
+*/
+extern bool EmitAOTOutput();
@@ -18,22 +18,29 @@
 #include <llvm/IR/PassManager.h>
 #include <llvm/IR/Value.h>
 #include <memory>
+#include <set>
 #include <llvm/Analysis/LoopAnalysisManager.h>
 #include <llvm/Analysis/CGSCCPassManager.h>
 #include <llvm/IR/LegacyPassManager.h>
 #include "ast/basic_ast.h"
 #include "jit/HoshinoJIT.h"
 
+/*
+    前端(词法分析、语法分析、IR生成)的状态都是thread_local的
+    守护进程中每个程序在自己的线程中编译 互不干扰 JIT(theJIT)则由所有线程共享
+*/
 // 一个不透明的对象 包含许多llvm数据 不必管它 (
-inline std::unique_ptr<llvm::LLVMContext> theContext;
+inline thread_local std::unique_ptr<llvm::LLVMContext> theContext;
 // 用于生成llvm指令的一个全局builder
-inline std::unique_ptr<llvm::IRBuilder<>> builder;
+inline thread_local std::unique_ptr<llvm::IRBuilder<>> builder;
 
 // module是llvm-ir用于包含代码的顶级结构 它拥有生成的所有ir的内存
 // 因为module的某些操作原因 所以code-generator要返回Value*而不是std::unique_ptr<Value>
-inline std::unique_ptr<llvm::Module>theModule;
+inline thread_local std::unique_ptr<llvm::Module>theModule;
+// AOT模式(--emit-obj/--emit-exe)下使用的目标机器 JIT模式下为nullptr
+inline std::unique_ptr<llvm::TargetMachine>theTargetMachine;
 // 包含当前作用范围内的变量的llvm表示
-inline std::map<std::string, llvm::AllocaInst*>namedValues;
+inline thread_local std::map<std::string, llvm::AllocaInst*>namedValues;
 /*
     全局的函数注册表
     顶层表达式执行时会将当前module交给匿名函数使用 外层会新生成一个module
@@ -50,7 +57,31 @@ inline std::map<std::string, llvm::AllocaInst*>namedValues;
            map中这个底层数据被释放的string_view就会与传入的参数进行比较，自然会引发内存错误
     =================================================================
 */
-inline std::map<std::string, std::unique_ptr<hoshino::PrototypeAST>>functionProtos;
+inline thread_local std::map<std::string, std::unique_ptr<hoshino::PrototypeAST>>functionProtos;
+/*
+    当前正在生成的函数体中静态调用到的函数名 包括CallExprAST以及binary@/unary@运算符调用
+    函数生成完成后交给HoshinoSpeculator作为调用图 用于推测编译
+*/
+inline thread_local std::set<std::string>calleeNames;
+/*
+    增量模式下已定义运算符(binary@/unary@)所在module的bitcode
+    之后的module调用运算符时 把函数体以available_externally的形式复制进来
+    由OptimizeLayer内联到调用处 JIT中仍然只有一份规范的定义
+*/
+inline thread_local std::map<std::string, std::string>operatorBodies;
+/*
+    复制了运算符函数体的定义: 运算符名 -> 这些定义的名字 以及每个这样的定义所在module的bitcode
+    运算符重新定义后 这些定义中内联的仍是旧的函数体 需要用新的函数体重新编译(RecompileOperatorInliners)
+*/
+inline thread_local std::map<std::string, std::set<std::string>>operatorInliners;
+inline thread_local std::map<std::string, std::string>inlinerBodies;
+/*
+    没有副作用的函数及其callee: 函数体只调用没有副作用的函数(或自身) 不调用extern
+    def pure函数只能调用其中的函数 重新定义时据此检查是否会让某个pure函数有副作用
+*/
+inline thread_local std::map<std::string, std::set<std::string>>sideEffectFree;
+// def pure定义的函数 调用结果缓存在运行时的memo表中
+inline thread_local std::set<std::string>memoFunctions;
 
 
 /*  
@@ -86,10 +117,20 @@ inline std::map<std::string, std::unique_ptr<hoshino::PrototypeAST>>functionProt
 // inline std::unique_ptr<llvm::StandardInstrumentations>theSI;
 
 inline void InitModuleAndManager(){
+    /*
+        旧的module与builder引用旧的context 必须先于context释放
+        thread_local变量按第一次使用的逆序析构 这里先使用theContext 线程退出时它也会最后析构
+    */
+    auto oldContext = std::move(theContext);
+    builder.reset();
+    theModule.reset();
+    oldContext.reset();
     // context and module
     theContext = std::make_unique<llvm::LLVMContext>();
+    memoryAccounting.TrackContext(*theContext);
     theModule = std::make_unique<llvm::Module>("jit module", *theContext);
-    theModule->setDataLayout(theJIT->getDataLayout());
+    theModule->setDataLayout(theJIT ? theJIT->getDataLayout() 
+                                    : theTargetMachine->createDataLayout());
     
     // builder
     builder = std::make_unique<llvm::IRBuilder<>>(*theContext);
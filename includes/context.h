@@ -2,12 +2,25 @@
 #include <memory>
 #include <string>
 #include <fstream>
+#include <istream>
 
 #define DEBUG
 
 
-inline std::unique_ptr<std::ifstream> sourceInput;
+// 词法分析的输入 普通模式下为源文件 守护进程模式下为客户端提交的脚本
+inline thread_local std::unique_ptr<std::istream> sourceInput;
 
+// 初始化运算符表、JIT、module与code generator 不打开任何源文件
+extern void InitContext();
 extern void SettingContext(std::string);
+/*
+    守护进程模式使用：
+    SavePreludeState在prelude加载完成后保存函数注册表与运算符优先级
+    ResetFrontendState在每个程序开始前把(当前线程的)前端状态恢复到prelude加载完成时的样子
+*/
+extern void SavePreludeState();
+extern void ResetFrontendState();
 extern void MainLoop();
-extern void ContextClose();
+// 回收当前JITDylib中不可达(被undef且没有可达的调用者)的函数定义
+extern void ReclaimUnreachableCode();
+extern int ContextClose();
@@ -0,0 +1,127 @@
+// HoshinoCodeStats
+#pragma once
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/BinaryFormat/ELF.h"
+#include "llvm/ExecutionEngine/JITLink/JITLink.h"
+#include "llvm/ExecutionEngine/Orc/Core.h"
+#include "llvm/ExecutionEngine/Orc/ObjectLinkingLayer.h"
+#include "llvm/Object/ELFObjectFile.h"
+#include "llvm/Object/ObjectFile.h"
+#include "llvm/Support/raw_ostream.h"
+#include "jit/HoshinoTimeReport.h"
+#include <mutex>
+
+namespace llvm {
+namespace orc {
+
+/*
+  按ResourceTracker统计JIT生成的代码与数据所占的字节数
+  作为ResourceManager注册到ExecutionSession上 ResourceTracker被remove时
+  ExecutionSession会通知它 于是可以统计被回收的字节数
+  RuntimeDyld与JITLink两种链接方式都在object加载完成后调用recordAllocation
+*/
+class HoshinoCodeStats : public ResourceManager {
+public:
+  // 把一个object加载后占用的字节数记到R所属的ResourceTracker上
+  void recordAllocation(MaterializationResponsibility &R, size_t Bytes) {
+    if (timeReport.Enabled())
+      timeReport.Record(Phase::Link, getDefinitionName(R), PhaseStats{0, 0, 0, Bytes});
+    if (auto Err = R.withResourceKeyDo([&](ResourceKey K) {
+          std::lock_guard<std::mutex> Lock(StatsMutex);
+          BytesByKey[K] += Bytes;
+          LiveBytes += Bytes;
+        }))
+      consumeError(std::move(Err));
+  }
+
+  // RuntimeDyld: object中所有需要加载到内存中的section的大小之和
+  static size_t getLoadedSize(const object::ObjectFile &Obj) {
+    size_t Bytes = 0;
+    for (auto &Sec : Obj.sections()) {
+      bool Alloc = Sec.isText() || Sec.isData() || Sec.isBSS();
+      if (isa<object::ELFObjectFileBase>(&Obj))
+        Alloc = object::ELFSectionRef(Sec).getFlags() & ELF::SHF_ALLOC;
+      if (Alloc)
+        Bytes += Sec.getSize();
+    }
+    return Bytes;
+  }
+
+  Error handleRemoveResources(ResourceKey K) override {
+    std::lock_guard<std::mutex> Lock(StatsMutex);
+    auto It = BytesByKey.find(K);
+    if (It == BytesByKey.end())
+      return Error::success();
+    LiveBytes -= It->second;
+    ReclaimedBytes += It->second;
+    BytesByKey.erase(It);
+    return Error::success();
+  }
+
+  void handleTransferResources(ResourceKey DstKey, ResourceKey SrcKey) override {
+    std::lock_guard<std::mutex> Lock(StatsMutex);
+    auto It = BytesByKey.find(SrcKey);
+    if (It == BytesByKey.end())
+      return;
+    BytesByKey[DstKey] += It->second;
+    BytesByKey.erase(SrcKey);
+  }
+
+  // 某个ResourceTracker当前占用的字节数
+  size_t getBytes(ResourceTracker &RT) const {
+    std::lock_guard<std::mutex> Lock(StatsMutex);
+    auto It = BytesByKey.find(RT.getKeyUnsafe());
+    return It == BytesByKey.end() ? 0 : It->second;
+  }
+
+  size_t getLiveBytes() const {
+    std::lock_guard<std::mutex> Lock(StatsMutex);
+    return LiveBytes;
+  }
+
+  size_t getReclaimedBytes() const {
+    std::lock_guard<std::mutex> Lock(StatsMutex);
+    return ReclaimedBytes;
+  }
+
+private:
+  mutable std::mutex StatsMutex;
+  DenseMap<ResourceKey, size_t> BytesByKey;
+  size_t LiveBytes = 0;
+  size_t ReclaimedBytes = 0;
+};
+
+/*
+  JITLink(ObjectLinkingLayer)的插件 在为LinkGraph分配好内存后统计各section的大小
+*/
+class HoshinoCodeStatsPlugin : public ObjectLinkingLayer::Plugin {
+public:
+  explicit HoshinoCodeStatsPlugin(HoshinoCodeStats &Stats) : Stats(Stats) {}
+
+  void modifyPassConfig(MaterializationResponsibility &MR, jitlink::LinkGraph &G,
+                        jitlink::PassConfiguration &Config) override {
+    Config.PostAllocationPasses.push_back([this, &MR](jitlink::LinkGraph &G) {
+      size_t Bytes = 0;
+      for (auto &Sec : G.sections())
+        Bytes += jitlink::SectionRange(Sec).getSize();
+      Stats.recordAllocation(MR, Bytes);
+      return Error::success();
+    });
+  }
+
+  Error notifyFailed(MaterializationResponsibility &MR) override {
+    return Error::success();
+  }
+  Error notifyRemovingResources(ResourceKey K) override {
+    return Error::success();
+  }
+  void notifyTransferringResources(ResourceKey DstKey,
+                                   ResourceKey SrcKey) override {}
+
+private:
+  HoshinoCodeStats &Stats;
+};
+
+} // end namespace orc
+} // end namespace llvm
@@ -10,28 +10,52 @@
 #include "llvm/ExecutionEngine/Orc/ExecutorProcessControl.h"
 #include "llvm/ExecutionEngine/Orc/IRCompileLayer.h"
 #include "llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h"
+#include "llvm/ExecutionEngine/Orc/ObjectLinkingLayer.h"
 #include "llvm/ExecutionEngine/Orc/RTDyldObjectLinkingLayer.h"
+#include "llvm/ExecutionEngine/JITLink/EHFrameSupport.h"
+#include "llvm/ExecutionEngine/Orc/TaskDispatch.h"
 #include "llvm/ExecutionEngine/SectionMemoryManager.h"
 #include "llvm/Transforms/InstCombine/InstCombine.h"
 #include "llvm/Transforms/Scalar/GVN.h"
 #include "llvm/Transforms/Scalar.h"
+#include "llvm/Transforms/IPO/AlwaysInliner.h"
+#include "llvm/Transforms/Utils.h"
+#include "llvm/ADT/STLExtras.h"
 #include "llvm/IR/DataLayout.h"
+#include "llvm/Passes/PassBuilder.h"
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/Support/TargetSelect.h"
 #include "llvm-14/llvm/ExecutionEngine/Orc/ThreadSafeModule.h"
 #include "llvm-14/llvm/IR/LegacyPassManager.h"
 #include "llvm-14/llvm/Support/raw_ostream.h"
-#include "llvm/ExecutionEngine/Orc/CompileOnDemandLayer.h"
+#include "llvm/ExecutionEngine/Orc/LazyReexports.h"
 #include "llvm/ExecutionEngine/Orc/EPCIndirectionUtils.h"
 #include "llvm-14/llvm/Support/Error.h"
 #include <cstdio>
+#include <limits>
 #include <llvm-14/llvm/ExecutionEngine/Orc/IndirectionUtils.h>
 #include <llvm-14/llvm/ExecutionEngine/Orc/LazyReexports.h>
 #include <llvm-14/llvm/ExecutionEngine/Orc/Shared/ExecutorAddress.h>
 #include <llvm-14/llvm/IR/Module.h>
+#include <atomic>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <set>
+#include <string>
 #include <utility>
+#include <vector>
 #include "context.h"
+#include "tools/options.h"
+#include "tools/remarks.h"
+#include "jit/HoshinoCodeStats.h"
+#include "jit/HoshinoMemoryManager.h"
+#include "jit/HoshinoNativeLibrary.h"
+#include "jit/HoshinoObjectCache.h"
+#include "jit/HoshinoPerfMap.h"
+#include "jit/HoshinoReclaimer.h"
+#include "jit/HoshinoSpeculator.h"
+#include "jit/HoshinoTimeReport.h"
 
 namespace llvm {
 namespace orc {
@@ -44,9 +68,26 @@ private:
   // DataLayout和MangleAndInterner用于符号修改
   DataLayout DL;
   MangleAndInterner Mangle;
-  // 这一层可以添加.o文件到JIT 不会直接使用它 
-  RTDyldObjectLinkingLayer ObjectLayer;
-  // 这一层可以添加LLVM Modules到JIT 并将Modules构建在ObjectLayer上
+  // 根据静态调用图 在函数第一次编译时把它的callee交给后台线程提前编译
+  HoshinoSpeculator Speculator;
+  // 所有object共享的JIT代码/数据内存池 需要在ObjLayer之前构造、之后析构
+  std::shared_ptr<SlabMemoryPool> MemPool;
+  // 按ResourceTracker统计代码/数据字节数 需要在ObjLayer之前构造
+  HoshinoCodeStats CodeStats;
+  // 每个函数定义的ResourceTracker 按可达性回收代码
+  HoshinoReclaimer Reclaimer;
+  // --perf时记录加载的函数供perf符号化 未开启时为nullptr 需要在ObjLayer之前构造
+  std::unique_ptr<HoshinoPerfMap> PerfMap;
+  /*
+    这一层可以添加.o文件到JIT 不会直接使用它
+    默认为RTDyldObjectLinkingLayer(RuntimeDyld) 使用--jitlink时为ObjectLinkingLayer(JITLink)
+  */
+  std::unique_ptr<ObjectLayer> ObjLayer;
+  // 开启--time-report/--trace时位于CompileLayer与ObjLayer之间 统计链接时间
+  std::unique_ptr<ObjectLayer> TimedObjLayer;
+  // 磁盘object缓存 未开启时为nullptr 需要在CompileLayer之前构造、之后析构
+  std::unique_ptr<HoshinoObjectCache> ObjCache;
+  // 这一层可以添加LLVM Modules到JIT 并将Modules构建在ObjLayer上
   IRCompileLayer CompileLayer;
   // 这一层在CompileLayer之上，构造时需要传入CompileLayer的引用，
   // 该层处理完后传入CompileLayer层处理
@@ -58,15 +99,26 @@ private:
   */
   // std::unique_ptr<LazyCallThroughManager>LCTM;
 
-  /* 
-    构建CompileOnDemandLayer需要一个IndirectStubsManager，
-    在JIT用addModule传入一个模块给CODLayer时，IndirectStubsManager会为Module
-    里的每个Funtion产生一个stub。而在每次stub代表的Funtion被call时，
-    CODLayer会使用LazyCallThroughManager对该Funtion进行编译，
-    对Funtion进行编译的函数叫partitioning funtion，
-    而事实上我们可以通过CompileOnDemandLayer::setPartitionFunction直接进行设置
+  /*
+    惰性编译 (原先使用CompileOnDemandLayer)
+    每个JITDylib有一个IndirectStubsManager以及一个"<name>.impl" dylib
+    addModule时函数体加入impl dylib 外层dylib中为每个函数定义一个lazy reexport:
+    IndirectStubsManager为函数产生一个stub 第一次被call时由LazyCallThroughManager
+    在impl dylib中lookup该函数 触发编译 再把stub指向编译好的函数
+    =================================================================
+    CompileOnDemandLayer把所有函数体都定义在impl dylib的默认ResourceTracker下 无法单独释放
+    这里每个定义的stub与函数体各有自己的ResourceTracker 由Reclaimer按可达性回收
+    (我们的每个Module只有一个函数定义 也不需要CompileOnDemandLayer的按函数划分)
+    =================================================================
   */
-  CompileOnDemandLayer CODLayer;
+  struct LazyDylib {
+    JITDylib *ImplJD;
+    std::unique_ptr<IndirectStubsManager> ISM;
+  };
+  std::mutex LazyDylibMutex;
+  std::map<JITDylib *, LazyDylib> LazyDylibs;
+  // 重新定义的函数体的版本号 函数体命名为"<name>$<version>"
+  std::atomic<unsigned> NextBodyVersion{1};
 
 
   /*
@@ -74,41 +126,90 @@ private:
     可以做到函数调用操作
   */
   JITDylib &MainJD;
+  /*
+    所有程序共享的prelude(公共的运算符与辅助函数) 它链接到MainJD上
+    prelude中的函数不经过惰性编译 加载完成时全部编译好(compilePrelude)
+    程序调用prelude函数时不需要经过stub 也不会在每个程序中重复编译
+  */
+  JITDylib &PreludeJD;
+  // 已加入PreludeJD但还未编译的函数
+  SymbolNameVector PendingPreludeSymbols;
+  /*
+    当前线程的程序所在的JITDylib nullptr表示MainJD
+    守护进程模式下每个提交的脚本在自己的线程中运行 并有自己的程序dylib
+    程序dylib的链接顺序为: 自身 -> PreludeJD -> MainJD
+  */
+  static inline thread_local JITDylib *CurJD = nullptr;
+  // 已清空可复用的程序dylib
+  std::mutex ProgramDylibMutex;
+  std::vector<JITDylib *> FreeProgramDylibs;
+  unsigned NextProgramID = 0;
+  /*
+    import加载的本地库 按路径只加载一次 符号的查找结果在各JITDylib之间共享
+    每个JITDylib上挂着它import的库的generator 程序dylib被清空时一并移除
+  */
+  std::mutex LibraryMutex;
+  std::map<std::string, std::shared_ptr<HoshinoNativeLibrary>> Libraries;
+  std::map<JITDylib *, std::vector<HoshinoLibraryGenerator *>> ImportedLibraries;
+  /*
+    执行中失败的惰性编译 按所在程序dylib的名字记录错误信息
+    函数体编译失败时调用者得到NaN 程序在执行完顶层表达式后取出这些错误并报告
+  */
+  std::mutex SessionErrorMutex;
+  std::map<std::string, std::vector<std::string>> SessionErrors;
 
 
 public:
   HoshinoJIT(std::unique_ptr<ExecutionSession> ES, std::unique_ptr<EPCIndirectionUtils>EPCIU,
-                  JITTargetMachineBuilder JTMB, DataLayout DL)
+                  JITTargetMachineBuilder JTMB, DataLayout DL, const HoshinoOptions &Opts)
       : ES(std::move(ES)), EPCIU(std::move(EPCIU)), DL(std::move(DL)), Mangle(*this->ES, this->DL),
-        ObjectLayer(*this->ES,
-                    []() { /*管理内存的分配、访问权限，添加的module会被其管理*/return std::make_unique<SectionMemoryManager>(); }),
-        CompileLayer(*this->ES, ObjectLayer,
-                     /*编译实例，用于将IR file编译为.o文件*/std::make_unique<ConcurrentIRCompiler>(std::move(JTMB))),
-        OptimizeLayer(*this->ES, CompileLayer, optimizeModule),
-        
-        CODLayer(*this->ES, OptimizeLayer, this->EPCIU->getLazyCallThroughManager(), 
-        [this]{return this->EPCIU->createIndirectStubsManager();}),
-        MainJD(this->ES->createBareJITDylib("<main>")) {
+        Speculator(*this->ES, Mangle),
+        MemPool(std::make_shared<SlabMemoryPool>()),
+        PerfMap(HoshinoPerfMap::Create(Opts.perf)),
+        ObjLayer(createObjectLayer(Opts.useJITLink)),
+        TimedObjLayer(PhaseTimersEnabled()
+                          ? std::make_unique<HoshinoTimedObjectLayer>(*this->ES, *ObjLayer)
+                          : nullptr),
+        ObjCache(createObjectCache(Opts, JTMB)),
+        CompileLayer(*this->ES, TimedObjLayer ? *TimedObjLayer : *ObjLayer,
+                     /*编译实例，用于将IR file编译为.o文件 开启缓存时先查找磁盘缓存*/
+                     createCompiler(std::move(JTMB))),
+        OptimizeLayer(*this->ES, CompileLayer,
+                      [this](ThreadSafeModule TSM, const MaterializationResponsibility &R) {
+                        return speculateAndOptimize(std::move(TSM), R);
+                      }),
+        MainJD(this->ES->createBareJITDylib("<main>")),
+        PreludeJD(this->ES->createBareJITDylib("<prelude>")) {
     MainJD.addGenerator(
         cantFail(DynamicLibrarySearchGenerator::GetForCurrentProcess(
         DL.getGlobalPrefix())));
-    if (JTMB.getTargetTriple().isOSBinFormatCOFF()) {
+    PreludeJD.setLinkOrder({{&MainJD, JITDylibLookupFlags::MatchExportedSymbolsOnly}});
+    this->ES->registerResourceManager(CodeStats);
+    this->ES->setErrorReporter([this](Error Err) { recordSessionError(std::move(Err)); });
+    if (!Opts.useJITLink && JTMB.getTargetTriple().isOSBinFormatCOFF()) {
+      auto &RTDyldLayer = static_cast<RTDyldObjectLinkingLayer &>(*ObjLayer);
       // 设置可重定义，新的定义覆盖旧的
-      ObjectLayer.setOverrideObjectFlagsWithResponsibilityFlags(true);
+      RTDyldLayer.setOverrideObjectFlagsWithResponsibilityFlags(true);
       // 设置自动声明，函数定义可自动声明
-      ObjectLayer.setAutoClaimResponsibilityForObjectSymbols(true);
+      RTDyldLayer.setAutoClaimResponsibilityForObjectSymbols(true);
     }
   }
 
   ~HoshinoJIT() {
     if (auto Err = ES->endSession())
       ES->reportError(std::move(Err));
+    ES->deregisterResourceManager(CodeStats);
     if(auto Err = EPCIU->cleanup())
       ES->reportError(std::move(Err));
   }
 
-  static Expected<std::unique_ptr<HoshinoJIT>> Create() {
-    auto EPC = SelfExecutorProcessControl::Create();
+  static Expected<std::unique_ptr<HoshinoJIT>> Create(const HoshinoOptions &Opts) {
+    /*
+      使用线程池分发materialization任务 推测编译的lookup是异步的
+      它触发的编译会在后台线程中进行 而不会阻塞当前执行的顶层表达式
+    */
+    auto EPC = SelfExecutorProcessControl::Create(
+        nullptr, std::make_unique<DynamicThreadPoolTaskDispatcher>());
     if (!EPC)
       return EPC.takeError();
     
@@ -129,22 +230,362 @@ public:
       return DL.takeError();
 
     return std::make_unique<HoshinoJIT>(std::move(ES), std::move(*EPCIU),
-    std::move(JTMB), std::move(*DL));
+    std::move(JTMB), std::move(*DL), Opts);
   }
 
   const DataLayout &getDataLayout() const { return DL; }
 
   JITDylib &getMainJITDylib() { return MainJD; }
 
-  Error addModule(ThreadSafeModule TSM, ResourceTrackerSP RT = nullptr) {
-    if (!RT)
-      RT = MainJD.getDefaultResourceTracker();
-    /*
-      将IR Module添加到JITDylib中，JITDylib会为Module中定义的每个函数创建一个符号表
-      并且JITDylib会推迟编译该Module，直到Module中的任何一个函数定义被lookup，此时才编译Module
-      注意：这并不是lazy compilation，lookup只是拿到函数定义的引用，并不是真正调用函数
-    */
-    return CODLayer.add(RT, std::move(TSM));
+  JITDylib &getPreludeJITDylib() { return PreludeJD; }
+
+  JITDylib &getCurrentJITDylib() { return CurJD ? *CurJD : MainJD; }
+
+  // 设置当前线程的程序所在的JITDylib
+  void setCurrentJITDylib(JITDylib &JD) { CurJD = &JD; }
+
+  /*
+    为一个新程序取得一个空的JITDylib 链接顺序为: 自身 -> PreludeJD -> MainJD
+    每个JITDylib的stub管理器以及"<name>.impl" dylib按JITDylib的地址保存
+    所以程序结束后不删除JITDylib 而是清空后放回空闲列表复用
+  */
+  JITDylib &acquireProgramDylib() {
+    JITDylib *JD = nullptr;
+    {
+      std::lock_guard<std::mutex> Lock(ProgramDylibMutex);
+      if (!FreeProgramDylibs.empty()) {
+        JD = FreeProgramDylibs.back();
+        FreeProgramDylibs.pop_back();
+      }
+    }
+    if (!JD) {
+      std::string Name;
+      {
+        std::lock_guard<std::mutex> Lock(ProgramDylibMutex);
+        Name = "<program-" + std::to_string(NextProgramID++) + ">";
+      }
+      JD = &ES->createBareJITDylib(std::move(Name));
+    }
+    JD->setLinkOrder({{&PreludeJD, JITDylibLookupFlags::MatchExportedSymbolsOnly},
+                      {&MainJD, JITDylibLookupFlags::MatchExportedSymbolsOnly}});
+    return *JD;
+  }
+
+  /*
+    import "path": 当前JITDylib中找不到的符号再到库中查找 同一个库只挂一次
+    库在这里就加载(路径错误时立即报告) 其中的符号在第一次被调用的代码查找时才解析
+  */
+  Error importLibrary(const std::string &Path) {
+    auto &JD = getCurrentJITDylib();
+    std::lock_guard<std::mutex> Lock(LibraryMutex);
+    auto &Lib = Libraries[Path];
+    if (!Lib) {
+      auto Loaded = HoshinoNativeLibrary::Load(Path);
+      if (!Loaded) {
+        Libraries.erase(Path);
+        return Loaded.takeError();
+      }
+      Lib = std::move(*Loaded);
+    }
+    auto &Generators = ImportedLibraries[&JD];
+    for (auto *G : Generators)
+      if (&G->getLibrary() == Lib.get())
+        return Error::success();
+    Generators.push_back(&JD.addGenerator(
+        std::make_unique<HoshinoLibraryGenerator>(Lib, DL.getGlobalPrefix())));
+    return Error::success();
+  }
+
+  /*
+    移除程序dylib(以及它的impl dylib)中的所有定义 编译出的代码与数据所占内存随之释放
+    代价只与该程序自身的大小有关 它import的库不再可见 复用它的下一个程序需要重新import
+  */
+  Error releaseProgramDylib(JITDylib &JD) {
+    if (CurJD == &JD)
+      CurJD = nullptr;
+    auto Err = JD.clear();
+    {
+      std::lock_guard<std::mutex> Lock(LibraryMutex);
+      if (auto It = ImportedLibraries.find(&JD); It != ImportedLibraries.end()) {
+        for (auto *G : It->second)
+          JD.removeGenerator(*G);
+        ImportedLibraries.erase(It);
+      }
+    }
+    if (auto *ImplJD = ES->getJITDylibByName(JD.getName() + ".impl"))
+      Err = joinErrors(std::move(Err), ImplJD->clear());
+    Speculator.removeDylib(JD.getName());
+    Reclaimer.removeDylib(JD.getName());
+    takeSessionErrors(JD);
+    std::lock_guard<std::mutex> Lock(ProgramDylibMutex);
+    FreeProgramDylibs.push_back(&JD);
+    return Err;
+  }
+
+  // 取出JD中的程序在执行时发生的JIT错误(比如惰性编译失败)
+  std::vector<std::string> takeSessionErrors(JITDylib &JD) {
+    std::lock_guard<std::mutex> Lock(SessionErrorMutex);
+    auto It = SessionErrors.find(JD.getName());
+    if (It == SessionErrors.end())
+      return {};
+    auto Errors = std::move(It->second);
+    SessionErrors.erase(It);
+    return Errors;
+  }
+
+  HoshinoSpeculator &getSpeculator() { return Speculator; }
+
+  const SlabMemoryPool &getMemoryPool() const { return *MemPool; }
+
+  const HoshinoCodeStats &getCodeStats() const { return CodeStats; }
+
+  const HoshinoReclaimer &getReclaimer() const { return Reclaimer; }
+
+  bool isUsingJITLink() const { return isa<ObjectLinkingLayer>(*ObjLayer); }
+
+  struct DefinitionMemory {
+    std::string Dylib;
+    std::string Name;
+    size_t Bytes = 0;           // 当前函数体的代码与数据
+    size_t SupersededBytes = 0; // 被重新定义取代、等待回收的旧函数体
+  };
+
+  // 每个函数定义的ResourceTracker所占的字节数 按字节数从大到小排列
+  std::vector<DefinitionMemory> getDefinitionMemory() {
+    std::vector<DefinitionMemory> Result;
+    Reclaimer.forEachDefinition([&](const std::string &Dylib, const std::string &Name,
+                                    const HoshinoReclaimer::Definition &Def) {
+      DefinitionMemory M{Dylib, Name};
+      if (Def.BodyRT)
+        M.Bytes = CodeStats.getBytes(*Def.BodyRT);
+      for (auto &RT : Def.Superseded)
+        M.SupersededBytes += CodeStats.getBytes(*RT);
+      Result.push_back(std::move(M));
+    });
+    llvm::sort(Result, [](const DefinitionMemory &L, const DefinitionMemory &R) {
+      return L.Bytes + L.SupersededBytes > R.Bytes + R.SupersededBytes;
+    });
+    return Result;
+  }
+
+  // 未开启--object-cache时返回nullptr
+  HoshinoObjectCache *getObjectCache() { return ObjCache.get(); }
+
+  /*
+    将函数定义的Module惰性地加入当前JITDylib 每个函数定义有自己的ResourceTracker
+    函数体加入impl dylib 只有在函数第一次被调用(或被推测编译)时才会优化和编译
+    外层dylib中只定义stub 调用者经过stub跳转到函数体
+    当前dylib中已有同名函数时为重新定义 见redefineFunction
+  */
+  Error addModule(ThreadSafeModule TSM) {
+    auto &JD = getCurrentJITDylib();
+    if (&JD == &PreludeJD)
+      return addPreludeModule(std::move(TSM));
+    auto &LD = getLazyDylib(JD);
+    std::string Redefined;
+    TSM.withModuleDo([&](Module &Mod) {
+      for (auto &F : Mod)
+        if (!F.isDeclarationForLinker() && Reclaimer.isDefined(JD.getName(), F.getName().str()))
+          Redefined = F.getName().str();
+    });
+    if (!Redefined.empty())
+      return redefineFunction(JD, LD, std::move(TSM), Redefined);
+    SymbolAliasMap Callables, NonCallables;
+    std::vector<std::string> Names;
+    TSM.withModuleDo([&](Module &Mod) {
+      for (auto &GV : Mod.global_values()) {
+        // available_externally的函数体是前端复制进来供内联的运算符 定义在别的module中
+        if (GV.isDeclarationForLinker() || GV.hasLocalLinkage())
+          continue;
+        auto Name = Mangle(GV.getName());
+        auto Flags = JITSymbolFlags::fromGlobalValue(GV);
+        if (isa<Function>(GV)) {
+          Callables[Name] = {Name, Flags | JITSymbolFlags::Callable};
+          Names.push_back(GV.getName().str());
+        } else {
+          NonCallables[Name] = {Name, Flags};
+        }
+      }
+    });
+    auto StubRT = JD.createResourceTracker();
+    auto BodyRT = LD.ImplJD->createResourceTracker();
+    if (auto Err = OptimizeLayer.add(BodyRT, std::move(TSM)))
+      return Err;
+    Error Err = Error::success();
+    if (!NonCallables.empty())
+      Err = JD.define(reexports(*LD.ImplJD, std::move(NonCallables)), StubRT);
+    if (!Err && !Callables.empty())
+      Err = JD.define(lazyReexports(EPCIU->getLazyCallThroughManager(), *LD.ISM,
+                                    *LD.ImplJD, std::move(Callables)),
+                      StubRT);
+    if (Err)
+      return joinErrors(std::move(Err), BodyRT->remove());
+    for (auto &Name : Names)
+      Reclaimer.addDefinition(JD.getName(), Name, StubRT, BodyRT);
+    return Error::success();
+  }
+
+  /*
+    函数不再能按名字调用(例如被undef) 返回当前dylib中是否存在该函数的定义
+    代码要等到reclaimUnreachable时 确认没有可达的调用者后才会被释放
+  */
+  bool unrootDefinition(StringRef Name) {
+    return Reclaimer.unroot(getCurrentJITDylib().getName(), Name.str());
+  }
+
+  struct ReclaimResult {
+    size_t Definitions = 0;
+    size_t Bytes = 0;
+  };
+
+  /*
+    回收当前dylib中不可达的函数定义(移除它们的stub与函数体)以及被重新定义取代的旧函数体
+    返回回收的定义数以及编译出的代码与数据字节数
+  */
+  Expected<ReclaimResult> reclaimUnreachable() {
+    auto &JD = getCurrentJITDylib();
+    auto DylibName = JD.getName();
+    auto Removed = Reclaimer.collect(DylibName, [&](const std::string &Name) {
+      return Speculator.getCallees(DylibName, Name);
+    });
+    ReclaimResult Result;
+    Error Err = Error::success();
+    for (auto &R : Removed) {
+      size_t Bytes = CodeStats.getBytes(*R.BodyRT);
+      auto RemoveErr = R.BodyRT->remove();
+      if (R.StubRT)
+        RemoveErr = joinErrors(std::move(RemoveErr), R.StubRT->remove());
+      if (RemoveErr) {
+        Err = joinErrors(std::move(Err), std::move(RemoveErr));
+        continue;
+      }
+      // 只回收被取代的旧函数体时 函数本身仍然存在
+      if (R.StubRT)
+        Speculator.unregister(DylibName, R.Name);
+      ++Result.Definitions;
+      Result.Bytes += Bytes;
+    }
+    if (Err)
+      return Err;
+    return Result;
+  }
+
+  /*
+    顶层表达式的匿名函数在加入后马上就会被调用 惰性编译对它没有意义
+    直接交给OptimizeLayer 使编译结果归属于传入的RT 移除时内存能够回到内存池
+  */
+  Error addEagerModule(ThreadSafeModule TSM, ResourceTrackerSP RT) {
+    return OptimizeLayer.add(RT, std::move(TSM));
+  }
+
+  // 已经优化过的Module(整体编译模式) 跳过OptimizeLayer直接编译
+  Error addOptimizedModule(ThreadSafeModule TSM, ResourceTrackerSP RT) {
+    return CompileLayer.add(RT, std::move(TSM));
+  }
+
+  /*
+    编译所有已加入PreludeJD的函数 prelude加载完成后调用
+    各个函数的编译由TaskDispatcher分发到线程池中并行进行
+  */
+  Error compilePrelude() {
+    if (PendingPreludeSymbols.empty())
+      return Error::success();
+    auto Symbols = ES->lookup(makeJITDylibSearchOrder(&PreludeJD),
+                              SymbolLookupSet(std::move(PendingPreludeSymbols)));
+    PendingPreludeSymbols.clear();
+    return Symbols.takeError();
+  }
+
+  /*
+    对Module中的每个函数运行优化Pass JIT的OptimizeLayer与AOT编译(--emit-obj/--emit-exe)共用
+  */
+  static void runFunctionPasses(Module &Mod) {
+      // pass and analysis manager
+      auto theFPM = std::make_unique<legacy::FunctionPassManager>(&Mod);
+      /*
+          优化alloca变量的调用 将不必要的alloca load与store改为寄存器SSA form
+          函数参数与if的结果都经过alloca传递 提升之后后面的Pass(尤其是TailCallElim)才能看清数据流
+      */
+      theFPM->add(createPromoteMemoryToRegisterPass());
+      /*
+          添加Instruction Combine Pass 该Pass旨在简化、消除某些不必要的指令
+          该Pass不会修改控制流图 且它的结果对DCE Pass(dead code pass)有重要作用
+          如，原指令为: %Y = 1 + %X，%Z = 1 + %Y
+          则经过该Pass后两条指令变为一条指令: %Z = 2 + %X
+      */ 
+      theFPM->add(createInstructionCombiningPass());
+      /*
+          该Pass用于重新关联可交换的表达式的顺序，为了更好促进常量表达式的传播
+          如，4+(x+5) 经过该Pass后变为：x+(4+5)
+      */
+      theFPM->add(createReassociatePass());
+      /*
+          GVN: Global Value Numbering，为每一个计算得到的值分配一个唯一编号
+          该Pass用于消除多余的values、loads以及指令
+          如，一段程序中出现了多次操作数相同的乘法，那么编译器可以将这些乘法合并为一个
+          一般GVN通过直接比较两个表达式的值是否相同来判断是否合并为一个表达式
+      */
+      theFPM->add(createGVNPass());
+      /*
+          CFG: Control Flow Graph 控制流图
+          该Pass用于简化以及规范化函数的控制流图
+      */
+      theFPM->add(createCFGSimplificationPass());
+      /*
+          尾调用消除: 把自身的尾递归调用改写为跳回函数开头的循环 参数变为循环的phi节点
+          深度递归因此只占用常数的栈空间 其余不能消除的尾调用保留前端标记的tail
+      */
+      theFPM->add(createTailCallEliminationPass());
+      theFPM->doInitialization();
+      for(auto &F : Mod){
+        theFPM->run(F);
+#ifdef DEBUG
+        fprintf(stderr, "Read Function optimized:\n");
+        F.print(errs());
+        fprintf(stderr, "\n");
+#endif
+      }
+  }
+
+  /*
+    前端复制进来的运算符函数体(available_externally, alwaysinline)在这里内联到调用处
+    运算符的参数在函数体中是alloca变量 内联后由SROA提升为SSA 之后的Pass才能把表达式化简为直线代码
+    最后删除这些副本 剩下的调用(比如递归)仍然经过stub调用JIT中唯一的定义
+  */
+  static void inlineOperatorCopies(Module &Mod) {
+    if (none_of(Mod, [](Function &F) { return F.hasAvailableExternallyLinkage(); }))
+      return;
+    legacy::PassManager PM;
+    PM.add(createAlwaysInlinerLegacyPass());
+    PM.add(createSROAPass());
+    PM.run(Mod);
+    for (auto &F : Mod)
+      if (F.hasAvailableExternallyLinkage())
+        F.deleteBody();
+  }
+
+  /*
+    整体编译模式(--whole-program)的过程间优化 整个源文件的函数都在同一个Module中
+    除了入口Roots(顶层表达式的匿名函数)之外的函数都改为internal linkage
+    于是内联之后不再被调用的函数(包括binary@/unary@运算符)可以被删除 参数与返回值也可以被改写
+    之后运行O2的模块级pipeline: IPSCCP、GlobalOpt、DeadArgElim、Inliner、SROA...
+  */
+  static void runWholeProgramPasses(Module &Mod, const std::vector<std::string> &Roots) {
+    for (auto &F : Mod)
+      if (!F.isDeclaration() && !is_contained(Roots, F.getName()))
+        F.setLinkage(GlobalValue::InternalLinkage);
+    LoopAnalysisManager LAM;
+    FunctionAnalysisManager FAM;
+    CGSCCAnalysisManager CGAM;
+    ModuleAnalysisManager MAM;
+    PassBuilder PB;
+    PB.registerModuleAnalyses(MAM);
+    PB.registerCGSCCAnalyses(CGAM);
+    PB.registerFunctionAnalyses(FAM);
+    PB.registerLoopAnalyses(LAM);
+    PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+    auto MPM = PB.buildPerModuleDefaultPipeline(OptimizationLevel::O2);
+    MPM.run(Mod, MAM);
   }
 
   Expected<JITEvaluatedSymbol> lookup(StringRef Name) {
@@ -155,9 +596,149 @@ public:
       使用mangle symbol的好处是让JIT中的代码能够便捷地与应用程序或共享库的预编译代码进行交互
       mangle：重整，即符号重命名，重命名后的名称取决于DataLayout，而DataLayout取决于目标平台
     */
-    return ES->lookup({&MainJD}, Mangle(Name.str()));
+    auto &JD = getCurrentJITDylib();
+    if (&JD == &MainJD)
+      return ES->lookup({&MainJD}, Mangle(Name.str()));
+    if (&JD == &PreludeJD)
+      return ES->lookup(makeJITDylibSearchOrder({&PreludeJD, &MainJD}), Mangle(Name.str()));
+    return ES->lookup(makeJITDylibSearchOrder({&JD, &PreludeJD, &MainJD}),
+                      Mangle(Name.str()));
   }
 private:
+  /*
+    热重定义：新的函数体改名为"<name>$<version>"后单独编译 再把外层dylib中该函数的stub指向它
+    所有调用者都经过stub调用该函数 因此下一次调用立即使用新的函数体 不需要重新编译调用者
+    旧的函数体不再被引用 交给Reclaimer按回收策略释放
+  */
+  Error redefineFunction(JITDylib &JD, LazyDylib &LD, ThreadSafeModule TSM,
+                         const std::string &Name) {
+    std::string BodyName = Name + "$" + std::to_string(NextBodyVersion++);
+    TSM.withModuleDo([&](Module &Mod) { Mod.getFunction(Name)->setName(BodyName); });
+    auto BodyRT = LD.ImplJD->createResourceTracker();
+    if (auto Err = OptimizeLayer.add(BodyRT, std::move(TSM)))
+      return Err;
+    // 只编译这一个函数
+    auto Body = ES->lookup(makeJITDylibSearchOrder(LD.ImplJD, JITDylibLookupFlags::MatchAllSymbols),
+                           Mangle(BodyName));
+    if (!Body)
+      return joinErrors(Body.takeError(), BodyRT->remove());
+    // lazy reexport在第一次被lookup时才创建stub 确保stub已经存在
+    auto StubName = Mangle(Name);
+    auto Stub = ES->lookup(makeJITDylibSearchOrder(&JD, JITDylibLookupFlags::MatchAllSymbols),
+                           StubName);
+    if (!Stub)
+      return joinErrors(Stub.takeError(), BodyRT->remove());
+    if (auto Err = LD.ISM->updatePointer(*StubName, Body->getAddress()))
+      return joinErrors(std::move(Err), BodyRT->remove());
+    Reclaimer.replaceBody(JD.getName(), Name, std::move(BodyRT));
+    return Error::success();
+  }
+
+  // prelude中的函数直接交给OptimizeLayer 记录下函数名 由compilePrelude统一编译
+  Error addPreludeModule(ThreadSafeModule TSM) {
+    TSM.withModuleDo([this](Module &Mod) {
+      for (auto &F : Mod)
+        if (!F.isDeclarationForLinker())
+          PendingPreludeSymbols.push_back(Mangle(F.getName()));
+    });
+    return OptimizeLayer.add(PreludeJD, std::move(TSM));
+  }
+
+  /*
+    RuntimeDyld: 每个object一个HoshinoMemoryManager 从共享的slab池中分配 移除后内存归还池中复用
+    JITLink: 使用EPC自带的进程内内存管理器(InProcessMemoryManager) 
+             并注册eh-frame 使JIT代码中的异常/栈回溯信息可用
+    两种方式都通过MainJD上的DynamicLibrarySearchGenerator解析builtin_lib中的符号
+  */
+  std::unique_ptr<ObjectLayer> createObjectLayer(bool UseJITLink) {
+    if (UseJITLink) {
+      auto Layer = std::make_unique<ObjectLinkingLayer>(
+          *ES, ES->getExecutorProcessControl().getMemMgr());
+      Layer->addPlugin(std::make_unique<EHFrameRegistrationPlugin>(
+          *ES, std::make_unique<jitlink::InProcessEHFrameRegistrar>()));
+      Layer->addPlugin(std::make_unique<HoshinoCodeStatsPlugin>(CodeStats));
+      if (PerfMap)
+        Layer->addPlugin(std::make_unique<HoshinoPerfMapPlugin>(*PerfMap));
+      return Layer;
+    }
+    auto Layer = std::make_unique<RTDyldObjectLinkingLayer>(*ES,
+        [Pool = MemPool]() {
+          /*管理内存的分配、访问权限，添加的module会被其管理*/
+          return std::make_unique<HoshinoMemoryManager>(Pool);
+        });
+    Layer->setNotifyLoaded([this](MaterializationResponsibility &R,
+                                  const object::ObjectFile &Obj,
+                                  const RuntimeDyld::LoadedObjectInfo &) {
+      CodeStats.recordAllocation(R, HoshinoCodeStats::getLoadedSize(Obj));
+    });
+    if (PerfMap)
+      Layer->registerJITEventListener(*PerfMap);
+    return Layer;
+  }
+  /*
+    取得JD的impl dylib与stub管理器 第一次使用时创建
+    impl dylib的链接顺序与JD相同(JD在最前) 函数体之间的调用也经过JD中的stub
+  */
+  LazyDylib &getLazyDylib(JITDylib &JD) {
+    std::lock_guard<std::mutex> Lock(LazyDylibMutex);
+    auto It = LazyDylibs.find(&JD);
+    if (It != LazyDylibs.end())
+      return It->second;
+    auto &ImplJD = ES->createBareJITDylib(JD.getName() + ".impl");
+    JITDylibSearchOrder Order;
+    JD.withLinkOrderDo([&](const JITDylibSearchOrder &O) { Order = O; });
+    ImplJD.setLinkOrder(std::move(Order), /*LinkAgainstThisJITDylibFirst=*/false);
+    return LazyDylibs[&JD] = {&ImplJD, EPCIU->createIndirectStubsManager()};
+  }
+  std::unique_ptr<IRCompileLayer::IRCompiler> createCompiler(JITTargetMachineBuilder JTMB) {
+    auto Compiler = std::make_unique<ConcurrentIRCompiler>(std::move(JTMB), ObjCache.get());
+    if (!PhaseTimersEnabled())
+      return Compiler;
+    return std::make_unique<HoshinoTimedCompiler>(std::move(Compiler));
+  }
+  std::unique_ptr<HoshinoObjectCache>
+  createObjectCache(const HoshinoOptions &Opts, const JITTargetMachineBuilder &JTMB) {
+    if (!Opts.objectCache)
+      return nullptr;
+    std::string TargetID = JTMB.getTargetTriple().str() + ":" + JTMB.getCPU() +
+                           ":" + JTMB.getFeatures().getString();
+    /*
+      缓存的key包含编译器实际使用的优化级别 LLVM 14的JITTargetMachineBuilder没有读取它的接口
+      这里与ConcurrentIRCompiler一样从JTMB创建TargetMachine 再从中取得
+      创建失败时编译同样会失败 不使用缓存
+    */
+    auto TM = JITTargetMachineBuilder(JTMB).createTargetMachine();
+    if (!TM) {
+      consumeError(TM.takeError());
+      return nullptr;
+    }
+    return std::make_unique<HoshinoObjectCache>(
+        Opts.cacheDir.empty() ? HoshinoObjectCache::getDefaultCacheDir() : Opts.cacheDir,
+        Opts.cacheSizeMB * 1024 * 1024, (*TM)->getOptLevel(), std::move(TargetID));
+  }
+  /*
+    惰性编译的函数体只有在第一次被请求时才会交给OptimizeLayer
+    因此这里就是函数第一次被编译的时机：先为其中定义的函数发起推测编译 再进行优化
+  */
+  Expected<ThreadSafeModule>
+  speculateAndOptimize(ThreadSafeModule TSM, const MaterializationResponsibility &R) {
+    // 惰性编译的函数体位于"<name>.impl"中 推测时callee同样在impl dylib中查找
+    StringRef Owner = R.getTargetJITDylib().getName();
+    Owner.consume_back(".impl");
+    JITDylibSearchOrder Order;
+    for (auto Name : {Owner.str(), MainJD.getName()}) {
+      auto *ImplJD = ES->getJITDylibByName(Name + ".impl");
+      if (ImplJD && (Order.empty() || Order.back().first != ImplJD))
+        Order.push_back({ImplJD, JITDylibLookupFlags::MatchAllSymbols});
+    }
+    // 重新定义的函数体名为"<name>$<version>" 调用图中记录的是原来的函数名
+    TSM.withModuleDo([&](Module &Mod){
+      for(auto &F : Mod)
+        if(!F.isDeclarationForLinker())
+          Speculator.speculateFor(Owner.str(), F.getName().split('$').first, Order);
+    });
+    return optimizeModule(std::move(TSM), R);
+  }
   /*
     将原来优化函数的操作改为加入jit时再对Module中的函数进行优化
     第二个参数MaterializationResponsibility用于查询进行模块优化的JIT的状态
@@ -166,52 +747,46 @@ private:
   */
   static Expected<orc::ThreadSafeModule>
   optimizeModule(orc::ThreadSafeModule M, const orc::MaterializationResponsibility &R){
-      M.withModuleDo([](Module &Mod){
-        // pass and analysis manager
-        auto theFPM = std::make_unique<legacy::FunctionPassManager>(&Mod);
-        /*
-            添加Instruction Combine Pass 该Pass旨在简化、消除某些不必要的指令
-            该Pass不会修改控制流图 且它的结果对DCE Pass(dead code pass)有重要作用
-            如，原指令为: %Y = 1 + %X，%Z = 1 + %Y
-            则经过该Pass后两条指令变为一条指令: %Z = 2 + %X
-        */ 
-        theFPM->add(createInstructionCombiningPass());
-        /*
-            该Pass用于重新关联可交换的表达式的顺序，为了更好促进常量表达式的传播
-            如，4+(x+5) 经过该Pass后变为：x+(4+5)
-        */
-        theFPM->add(createReassociatePass());
-        /*
-            GVN: Global Value Numbering，为每一个计算得到的值分配一个唯一编号
-            该Pass用于消除多余的values、loads以及指令
-            如，一段程序中出现了多次操作数相同的乘法，那么编译器可以将这些乘法合并为一个
-            一般GVN通过直接比较两个表达式的值是否相同来判断是否合并为一个表达式
-        */
-        theFPM->add(createGVNPass());
-        /*
-            CFG: Control Flow Graph 控制流图
-            该Pass用于简化以及规范化函数的控制流图
-        */
-        theFPM->add(createCFGSimplificationPass());
-        // 优化alloca变量的调用 将不必要的alloca load与store改为寄存器SSA form
-        // theFPM->add(llvm::createPromoteMemoryToRegisterPass());
-        theFPM->doInitialization();
-        for(auto &F : Mod){
-          theFPM->run(F);
-#ifdef DEBUG
-          fprintf(stderr, "Read Function optimized:\n");
-          F.print(errs());
-          fprintf(stderr, "\n");
-#endif
-        }
+      M.withModuleDo([](Module &Mod) {
+        PhaseTimer Timer(Phase::Optimize, getDefinitionName(Mod));
+        RemarkScope Remarks(Mod.getContext());
+        inlineOperatorCopies(Mod);
+        runFunctionPasses(Mod);
+        Timer.AddBytes(Mod.getInstructionCount());
       });
       
       // fprintf(stderr, "\n");
       return M;
     }
-    static void handleLazyCallThroughError() {
-      errs() << "LazyCallThrough error: Could not find function body";
-      exit(1);
+    /*
+      惰性编译失败时stub跳转到这里代替函数体 hoshino的函数体都返回double 这里返回NaN
+      错误已经由recordSessionError记到所在的程序上 守护进程不会因为一个程序的错误而退出
+    */
+    static double handleLazyCallThroughError() {
+      return std::numeric_limits<double>::quiet_NaN();
+    }
+    /*
+      ExecutionSession的错误: 打印到stderr(守护进程的日志)
+      materialization失败的错误同时按符号所在的程序dylib记录 ("<name>.impl"记到"<name>"上)
+    */
+    void recordSessionError(Error Err) {
+      handleAllErrors(std::move(Err),
+        [this](const FailedToMaterialize &F) {
+          std::string Message = F.message();
+          errs() << "JIT session error: " << Message << "\n";
+          std::set<std::string> Owners;
+          for (auto &KV : F.getSymbols()) {
+            StringRef Owner = KV.first->getName();
+            Owner.consume_back(".impl");
+            Owners.insert(Owner.str());
+          }
+          std::lock_guard<std::mutex> Lock(SessionErrorMutex);
+          for (auto &Owner : Owners)
+            SessionErrors[Owner].push_back(Message);
+        },
+        [](const ErrorInfoBase &EIB) {
+          errs() << "JIT session error: " << EIB.message() << "\n";
+        });
     }
 
 };
@@ -226,7 +801,7 @@ inline void InitJIT(){
     llvm::InitializeNativeTargetAsmPrinter();
     llvm::InitializeNativeTargetAsmParser();
 
-    theJIT = exitOnErr(llvm::orc::HoshinoJIT::Create());
+    theJIT = exitOnErr(llvm::orc::HoshinoJIT::Create(hoshinoOptions));
     
 }
 
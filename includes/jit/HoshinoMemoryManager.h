@@ -0,0 +1,284 @@
+// HoshinoMemoryManager
+#pragma once
+
+#include "llvm/ExecutionEngine/RTDyldMemoryManager.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/Memory.h"
+#include "llvm/Support/Process.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace llvm {
+namespace orc {
+
+/*
+  JIT代码与数据的slab内存池
+  RTDyldObjectLinkingLayer原先为每个object创建一个SectionMemoryManager
+  每个顶层表达式都会mmap新的页、mprotect 之后res_tracker->remove()时又munmap
+  这里改为从大块的slab中按页切出内存 object被移除后内存回到空闲链表中复用
+  代码、只读数据、可读写数据分开放在不同的slab中 保证同一页的权限一致：
+    - RWData 始终为可读写 不需要mprotect
+    - Code/ROData 在finalize时改为RX/R 释放回池中时改回RW
+*/
+class SlabMemoryPool {
+public:
+  enum Kind { Code = 0, ROData, RWData, NumKinds };
+
+  struct KindStats {
+    size_t SlabCount = 0;
+    size_t MappedBytes = 0;  // 所有slab的总大小
+    size_t InUseBytes = 0;   // 当前被object占用的字节数(按页对齐)
+    size_t PeakInUseBytes = 0;
+    size_t Allocations = 0;  // 切出内存块的次数
+    size_t Reused = 0;       // 其中复用已释放内存的次数
+  };
+
+  explicit SlabMemoryPool(size_t SlabSize = 4 * 1024 * 1024)
+      : PageSize(sys::Process::getPageSizeEstimate()),
+        SlabSize(alignTo(SlabSize, PageSize)) {}
+
+  SlabMemoryPool(const SlabMemoryPool &) = delete;
+  SlabMemoryPool &operator=(const SlabMemoryPool &) = delete;
+
+  ~SlabMemoryPool() {
+    for (auto &PerKind : Slabs)
+      for (auto &S : PerKind)
+        sys::Memory::releaseMappedMemory(S.Block);
+  }
+
+  size_t getPageSize() const { return PageSize; }
+
+  /*
+    从对应类型的池中切出至少Size字节(按页对齐)的可读写内存 失败时返回空的MemoryBlock
+    优先复用已释放的内存(first fit) 其次从当前slab的未使用部分切 最后才映射新的slab
+  */
+  sys::MemoryBlock allocate(Kind K, size_t Size) {
+    Size = alignTo(std::max<size_t>(Size, 1), PageSize);
+    std::lock_guard<std::mutex> Lock(PoolMutex);
+    auto &S = Stats[K];
+    uintptr_t Addr = 0;
+    auto &Free = FreeRanges[K];
+    auto It = std::find_if(Free.begin(), Free.end(),
+                           [Size](auto &R) { return R.second >= Size; });
+    if (It != Free.end()) {
+      Addr = It->first;
+      size_t Avail = It->second;
+      Free.erase(It);
+      if (Avail > Size)
+        Free.emplace(Addr + Size, Avail - Size);
+      ++S.Reused;
+    } else {
+      auto &PerKind = Slabs[K];
+      if (PerKind.empty() ||
+          PerKind.back().Top + Size > PerKind.back().Block.allocatedSize()) {
+        std::error_code EC;
+        auto Block = sys::Memory::allocateMappedMemory(
+            std::max(SlabSize, Size), nullptr,
+            sys::Memory::MF_READ | sys::Memory::MF_WRITE, EC);
+        if (EC)
+          return sys::MemoryBlock();
+        PerKind.push_back({Block, 0});
+        ++S.SlabCount;
+        S.MappedBytes += Block.allocatedSize();
+      }
+      auto &Slab = PerKind.back();
+      Addr = reinterpret_cast<uintptr_t>(Slab.Block.base()) + Slab.Top;
+      Slab.Top += Size;
+    }
+    ++S.Allocations;
+    S.InUseBytes += Size;
+    S.PeakInUseBytes = std::max(S.PeakInUseBytes, S.InUseBytes);
+    return sys::MemoryBlock(reinterpret_cast<void *>(Addr), Size);
+  }
+
+  // 将内存块归还给池 Code/ROData先恢复为可读写 再与相邻的空闲块合并
+  void release(Kind K, sys::MemoryBlock Block) {
+    if (!Block.base())
+      return;
+    if (K != RWData)
+      sys::Memory::protectMappedMemory(
+          Block, sys::Memory::MF_READ | sys::Memory::MF_WRITE);
+    std::lock_guard<std::mutex> Lock(PoolMutex);
+    auto &Free = FreeRanges[K];
+    uintptr_t Addr = reinterpret_cast<uintptr_t>(Block.base());
+    size_t Size = Block.allocatedSize();
+    Stats[K].InUseBytes -= Size;
+    auto Next = Free.lower_bound(Addr);
+    // 与后一个空闲块合并
+    if (Next != Free.end() && Addr + Size == Next->first &&
+        sameSlab(K, Addr, Next->first)) {
+      Size += Next->second;
+      Next = Free.erase(Next);
+    }
+    // 与前一个空闲块合并
+    if (Next != Free.begin()) {
+      auto Prev = std::prev(Next);
+      if (Prev->first + Prev->second == Addr && sameSlab(K, Prev->first, Addr)) {
+        Prev->second += Size;
+        return;
+      }
+    }
+    Free.emplace(Addr, Size);
+  }
+
+  KindStats getStats(Kind K) const {
+    std::lock_guard<std::mutex> Lock(PoolMutex);
+    return Stats[K];
+  }
+
+  // 打印slab使用情况 利用率 = 当前占用 / 已映射的slab大小
+  void printStats(raw_ostream &OS) const {
+    static const char *Names[NumKinds] = {"code", "rodata", "rwdata"};
+    OS << "JIT memory slabs (page size " << PageSize << ", slab size "
+       << SlabSize << "):\n";
+    for (int K = 0; K < NumKinds; ++K) {
+      auto S = getStats(static_cast<Kind>(K));
+      double Util = S.MappedBytes ? 100.0 * S.InUseBytes / S.MappedBytes : 0;
+      OS << "  " << Names[K] << ": slabs=" << S.SlabCount
+         << " mapped=" << S.MappedBytes << " in-use=" << S.InUseBytes
+         << " peak=" << S.PeakInUseBytes << " allocs=" << S.Allocations
+         << " reused=" << S.Reused << " utilisation=";
+      OS << format("%.1f%%", Util) << "\n";
+    }
+  }
+
+private:
+  struct Slab {
+    sys::MemoryBlock Block;
+    size_t Top; // slab中尚未切出过的部分的起始偏移
+  };
+
+  // 判断两个地址是否在同一个slab中 不同slab的内存不能合并
+  bool sameSlab(Kind K, uintptr_t A, uintptr_t B) const {
+    for (auto &S : Slabs[K]) {
+      auto Base = reinterpret_cast<uintptr_t>(S.Block.base());
+      auto End = Base + S.Block.allocatedSize();
+      if (A >= Base && A < End)
+        return B >= Base && B < End;
+    }
+    return false;
+  }
+
+  size_t PageSize;
+  size_t SlabSize;
+  mutable std::mutex PoolMutex;
+  std::vector<Slab> Slabs[NumKinds];
+  // 每种内存已释放可复用的空闲块 起始地址 -> 大小
+  std::map<uintptr_t, size_t> FreeRanges[NumKinds];
+  KindStats Stats[NumKinds];
+};
+
+/*
+  每个object对应一个HoshinoMemoryManager 它从SlabMemoryPool中取内存
+  RuntimeDyld会先调用reserveAllocationSpace告知该object各类section的总大小
+  因此每个object每类内存只需从池中切一次 各个section在其中顺序分配
+  object被移除(ResourceTracker::remove)时析构 内存归还给池
+*/
+class HoshinoMemoryManager : public RTDyldMemoryManager {
+public:
+  explicit HoshinoMemoryManager(std::shared_ptr<SlabMemoryPool> Pool)
+      : Pool(std::move(Pool)) {}
+
+  ~HoshinoMemoryManager() override {
+    for (int K = 0; K < SlabMemoryPool::NumKinds; ++K)
+      for (auto &Chunk : Chunks[K])
+        Pool->release(static_cast<SlabMemoryPool::Kind>(K), Chunk.Block);
+  }
+
+  bool needsToReserveAllocationSpace() override { return true; }
+
+  void reserveAllocationSpace(uintptr_t CodeSize, uint32_t CodeAlign,
+                              uintptr_t RODataSize, uint32_t RODataAlign,
+                              uintptr_t RWDataSize,
+                              uint32_t RWDataAlign) override {
+    reserve(SlabMemoryPool::Code, CodeSize);
+    reserve(SlabMemoryPool::ROData, RODataSize);
+    reserve(SlabMemoryPool::RWData, RWDataSize);
+  }
+
+  uint8_t *allocateCodeSection(uintptr_t Size, unsigned Alignment,
+                               unsigned SectionID,
+                               StringRef SectionName) override {
+    return allocate(SlabMemoryPool::Code, Size, Alignment);
+  }
+
+  uint8_t *allocateDataSection(uintptr_t Size, unsigned Alignment,
+                               unsigned SectionID, StringRef SectionName,
+                               bool IsReadOnly) override {
+    return allocate(IsReadOnly ? SlabMemoryPool::ROData
+                               : SlabMemoryPool::RWData,
+                    Size, Alignment);
+  }
+
+  bool finalizeMemory(std::string *ErrMsg = nullptr) override {
+    for (auto &Chunk : Chunks[SlabMemoryPool::Code]) {
+      if (auto EC = sys::Memory::protectMappedMemory(
+              Chunk.Block, sys::Memory::MF_READ | sys::Memory::MF_EXEC)) {
+        if (ErrMsg)
+          *ErrMsg = EC.message();
+        return true;
+      }
+      sys::Memory::InvalidateInstructionCache(Chunk.Block.base(),
+                                              Chunk.Block.allocatedSize());
+    }
+    for (auto &Chunk : Chunks[SlabMemoryPool::ROData]) {
+      if (auto EC = sys::Memory::protectMappedMemory(Chunk.Block,
+                                                     sys::Memory::MF_READ)) {
+        if (ErrMsg)
+          *ErrMsg = EC.message();
+        return true;
+      }
+    }
+    return false;
+  }
+
+private:
+  struct Chunk {
+    sys::MemoryBlock Block;
+    size_t Used = 0;
+  };
+
+  void reserve(SlabMemoryPool::Kind K, uintptr_t Size) {
+    if (!Size)
+      return;
+    auto Block = Pool->allocate(K, Size);
+    if (Block.base())
+      Chunks[K].push_back({Block, 0});
+  }
+
+  uint8_t *allocate(SlabMemoryPool::Kind K, uintptr_t Size,
+                    unsigned Alignment) {
+    Alignment = std::max(Alignment, 16u);
+    // 先在已经切出的内存块中顺序分配
+    for (auto &C : Chunks[K]) {
+      auto Base = reinterpret_cast<uintptr_t>(C.Block.base());
+      uintptr_t Addr = alignTo(Base + C.Used, Alignment);
+      if (Addr + Size <= Base + C.Block.allocatedSize()) {
+        C.Used = Addr + Size - Base;
+        return reinterpret_cast<uint8_t *>(Addr);
+      }
+    }
+    // reserve的大小不够(例如对齐带来的填充) 再从池中切一块
+    auto Block = Pool->allocate(K, Size + Alignment);
+    if (!Block.base())
+      return nullptr;
+    Chunks[K].push_back({Block, 0});
+    auto &C = Chunks[K].back();
+    auto Base = reinterpret_cast<uintptr_t>(Block.base());
+    uintptr_t Addr = alignTo(Base, Alignment);
+    C.Used = Addr + Size - Base;
+    return reinterpret_cast<uint8_t *>(Addr);
+  }
+
+  std::shared_ptr<SlabMemoryPool> Pool;
+  std::vector<Chunk> Chunks[SlabMemoryPool::NumKinds];
+};
+
+} // end namespace orc
+} // end namespace llvm
@@ -0,0 +1,90 @@
+// HoshinoNativeLibrary
+#pragma once
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ExecutionEngine/JITSymbol.h"
+#include "llvm/ExecutionEngine/Orc/Core.h"
+#include "llvm/Support/Error.h"
+#include <dlfcn.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+
+namespace llvm {
+namespace orc {
+
+/*
+  import "libfoo.so"加载的本地库
+  库以RTLD_LOCAL打开 其中的符号不进入进程的全局符号表 只有import了它的JITDylib能看到
+  符号在JIT第一次查找它时才dlsym 结果(包括库中没有的符号)缓存在这里
+  JITDylib被清空后再次查找 或者守护进程中另一个程序import同一个库时都不再dlsym
+  库加载后不再卸载: 编译出的代码中可能仍保存着库中函数的地址
+*/
+class HoshinoNativeLibrary {
+public:
+  static Expected<std::shared_ptr<HoshinoNativeLibrary>> Load(const std::string &Path) {
+    void *Handle = dlopen(Path.c_str(), RTLD_LAZY | RTLD_LOCAL);
+    if (!Handle)
+      return make_error<StringError>(dlerror(), inconvertibleErrorCode());
+    return std::make_shared<HoshinoNativeLibrary>(Path, Handle);
+  }
+
+  HoshinoNativeLibrary(std::string Path, void *Handle)
+      : Path(std::move(Path)), Handle(Handle) {}
+
+  const std::string &getPath() const { return Path; }
+
+  // 未mangle的符号名 -> 地址 库中没有该符号时返回0
+  JITTargetAddress lookup(StringRef Name) {
+    std::lock_guard<std::mutex> Lock(CacheMutex);
+    auto [It, Inserted] = Cache.try_emplace(Name, 0);
+    if (Inserted)
+      It->second = pointerToJITTargetAddress(dlsym(Handle, It->first().str().c_str()));
+    return It->second;
+  }
+
+private:
+  std::string Path;
+  void *Handle;
+  std::mutex CacheMutex;
+  StringMap<JITTargetAddress> Cache;
+};
+
+/*
+  挂在JITDylib上的generator JITDylib中找不到的符号到库中查找
+  找到的符号作为absolute symbol定义到JITDylib中 之后的查找直接命中JITDylib
+*/
+class HoshinoLibraryGenerator : public DefinitionGenerator {
+public:
+  HoshinoLibraryGenerator(std::shared_ptr<HoshinoNativeLibrary> Lib, char GlobalPrefix)
+      : Lib(std::move(Lib)), GlobalPrefix(GlobalPrefix) {}
+
+  const HoshinoNativeLibrary &getLibrary() const { return *Lib; }
+
+  Error tryToGenerate(LookupState &LS, LookupKind K, JITDylib &JD,
+                      JITDylibLookupFlags JDLookupFlags,
+                      const SymbolLookupSet &Symbols) override {
+    SymbolMap NewSymbols;
+    for (auto &KV : Symbols) {
+      StringRef Name = *KV.first;
+      if (GlobalPrefix != '\0') {
+        if (!Name.startswith(StringRef(&GlobalPrefix, 1)))
+          continue;
+        Name = Name.drop_front();
+      }
+      if (auto Addr = Lib->lookup(Name))
+        NewSymbols[KV.first] = JITEvaluatedSymbol(Addr, JITSymbolFlags::Exported);
+    }
+    if (NewSymbols.empty())
+      return Error::success();
+    return JD.define(absoluteSymbols(std::move(NewSymbols)));
+  }
+
+private:
+  std::shared_ptr<HoshinoNativeLibrary> Lib;
+  char GlobalPrefix;
+};
+
+} // end namespace orc
+} // end namespace llvm
@@ -0,0 +1,156 @@
+// HoshinoObjectCache
+#pragma once
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ExecutionEngine/ObjectCache.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/CachePruning.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Process.h"
+#include "llvm/Support/SHA1.h"
+#include "llvm/Support/raw_ostream.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace llvm {
+namespace orc {
+
+/*
+  持久化的磁盘object缓存 挂在IRCompileLayer的编译器(ConcurrentIRCompiler)上
+  IRCompileLayer在把Module交给TargetMachine做codegen之前会先调用getObject
+  命中时直接使用磁盘上的object 跳过codegen；未命中时codegen完成后调用notifyObjectCompiled写入缓存
+  =================================================================
+  缓存key = SHA1(优化后(即codegen输入)的IR文本 + 优化等级 + 目标三元组/CPU)
+  每个脚本开头相同的运算符定义(binary@|| binary@&& binary@==...)在不同脚本之间也能命中
+  缓存文件名为"llvmcache-<key>" 以便直接使用llvm::pruneCache按大小/访问时间淘汰
+  =================================================================
+*/
+class HoshinoObjectCache : public ObjectCache {
+public:
+  HoshinoObjectCache(std::string CacheDir, uint64_t MaxSizeBytes,
+                     unsigned OptLevel, std::string TargetID)
+      : CacheDir(std::move(CacheDir)), MaxSizeBytes(MaxSizeBytes),
+        OptLevel(OptLevel), TargetID(std::move(TargetID)) {
+    sys::fs::create_directories(this->CacheDir);
+  }
+
+  // 进程结束时按缓存大小上限淘汰最久未访问的object
+  ~HoshinoObjectCache() override { prune(); }
+
+  std::unique_ptr<MemoryBuffer> getObject(const Module *M) override {
+    auto Key = computeKey(*M);
+    auto Path = getCachePath(Key);
+    auto Buf = MemoryBuffer::getFile(Path, /*IsText=*/false,
+                                     /*RequiresNullTerminator=*/false);
+    if (!Buf) {
+      ++Misses;
+      // codegen会修改Module 因此notifyObjectCompiled时使用这里算出的key
+      std::lock_guard<std::mutex> Lock(KeyMutex);
+      PendingKeys[M] = std::move(Key);
+      return nullptr;
+    }
+    ++Hits;
+    // 更新访问时间 淘汰时按最近访问排序
+    int FD;
+    if (!sys::fs::openFileForWrite(Path, FD, sys::fs::CD_OpenExisting)) {
+      sys::fs::setLastAccessAndModificationTime(FD,
+                                                std::chrono::system_clock::now());
+      sys::Process::SafelyCloseFileDescriptor(FD);
+    }
+    return MemoryBuffer::getMemBufferCopy((*Buf)->getBuffer(),
+                                          (*Buf)->getBufferIdentifier());
+  }
+
+  void notifyObjectCompiled(const Module *M, MemoryBufferRef Obj) override {
+    std::string Key;
+    {
+      std::lock_guard<std::mutex> Lock(KeyMutex);
+      auto It = PendingKeys.find(M);
+      if (It == PendingKeys.end())
+        return;
+      Key = std::move(It->second);
+      PendingKeys.erase(It);
+    }
+    // 先写到临时文件再rename 避免多个hoshino进程同时写同一个缓存文件
+    SmallString<128> TmpPath;
+    int FD;
+    if (sys::fs::createUniqueFile(getCachePath(Key) + ".tmp-%%%%%%", FD,
+                                  TmpPath))
+      return;
+    {
+      raw_fd_ostream OS(FD, /*shouldClose=*/true);
+      OS << Obj.getBuffer();
+      if (OS.has_error()) {
+        OS.clear_error();
+        sys::fs::remove(TmpPath);
+        return;
+      }
+    }
+    if (sys::fs::rename(TmpPath, getCachePath(Key)))
+      sys::fs::remove(TmpPath);
+    else
+      ++Stores;
+  }
+
+  void prune() {
+    CachePruningPolicy Policy;
+    Policy.Interval = std::chrono::seconds(0);
+    Policy.MaxSizeBytes = MaxSizeBytes;
+    pruneCache(CacheDir, Policy);
+  }
+
+  void printStats(raw_ostream &OS) const {
+    OS << "object cache (" << CacheDir << "): hits=" << Hits
+       << " misses=" << Misses << " stores=" << Stores << "\n";
+  }
+
+  // 默认缓存目录 ~/.cache/hoshino
+  static std::string getDefaultCacheDir() {
+    SmallString<128> Dir;
+    if (!sys::path::cache_directory(Dir))
+      sys::fs::current_path(Dir);
+    sys::path::append(Dir, "hoshino");
+    return std::string(Dir);
+  }
+
+private:
+  std::string computeKey(const Module &M) const {
+    std::string IR;
+    raw_string_ostream OS(IR);
+    // ModuleID与source_filename不影响生成的代码 不参与hash
+    for (auto &GV : M.globals())
+      GV.print(OS);
+    for (auto &F : M)
+      F.print(OS);
+    OS << M.getDataLayoutStr() << '\0' << M.getTargetTriple() << '\0';
+    OS.flush();
+    SHA1 Hasher;
+    Hasher.update(IR);
+    Hasher.update(TargetID);
+    Hasher.update(utostr(OptLevel));
+    return toHex(Hasher.final(), /*LowerCase=*/true);
+  }
+
+  std::string getCachePath(StringRef Key) const {
+    SmallString<128> Path(CacheDir);
+    sys::path::append(Path, "llvmcache-" + Key);
+    return std::string(Path);
+  }
+
+  std::string CacheDir;
+  uint64_t MaxSizeBytes;
+  unsigned OptLevel;
+  // 目标三元组与CPU 不同机器编译出的object不能混用
+  std::string TargetID;
+  std::mutex KeyMutex;
+  DenseMap<const Module *, std::string> PendingKeys;
+  std::atomic<size_t> Hits{0}, Misses{0}, Stores{0};
+};
+
+} // end namespace orc
+} // end namespace llvm
@@ -0,0 +1,208 @@
+// HoshinoPerfMap
+#pragma once
+
+#include "llvm/BinaryFormat/ELF.h"
+#include "llvm/ExecutionEngine/JITEventListener.h"
+#include "llvm/ExecutionEngine/JITLink/JITLink.h"
+#include "llvm/ExecutionEngine/Orc/Core.h"
+#include "llvm/ExecutionEngine/Orc/ObjectLinkingLayer.h"
+#include "llvm/Object/ObjectFile.h"
+#include "llvm/Object/SymbolSize.h"
+#include "tools/options.h"
+#include "tools/source_locations.h"
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <fcntl.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace llvm {
+namespace orc {
+
+/*
+  --perf=map|jitdump: 让perf能够识别JIT生成的函数
+  map:     每个加载的函数向/tmp/perf-<pid>.map追加一行"<地址> <大小> <名字>"
+           perf report/perf top直接读取 不需要额外的步骤
+  jitdump: 写/tmp/jit-<pid>.dump 其中带有函数的机器码 需要用perf record -k mono记录
+           再用perf inject --jit合并 之后perf annotate也能看到JIT函数的指令
+  函数名后附上定义所在的源码位置 顶层表达式的__anon_expr_N因此能对应到源码中的那一行
+*/
+class HoshinoPerfMap : public JITEventListener {
+public:
+  static std::unique_ptr<HoshinoPerfMap> Create(PerfSupport Mode) {
+    if (Mode == PerfSupport::None)
+      return nullptr;
+    auto Map = std::unique_ptr<HoshinoPerfMap>(new HoshinoPerfMap(Mode));
+    if (!Map->Out) {
+      fprintf(stderr, "Warning: could not open %s, JIT functions will not be symbolized\n",
+              Map->Path.c_str());
+      return nullptr;
+    }
+    return Map;
+  }
+
+  ~HoshinoPerfMap() override {
+    if (Out)
+      fclose(Out);
+    if (Marker)
+      munmap(Marker, getpagesize());
+  }
+
+  // RuntimeDyld: object完成重定位、设置好内存权限后调用
+  void notifyObjectLoaded(ObjectKey K, const object::ObjectFile &Obj,
+                          const RuntimeDyld::LoadedObjectInfo &L) override {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    for (auto &[Sym, Size] : object::computeSymbolSizes(Obj)) {
+      auto Type = Sym.getType();
+      auto Name = Sym.getName();
+      auto Sec = Sym.getSection();
+      auto Addr = Sym.getAddress();
+      if (!Type || !Name || !Sec || !Addr) {
+        consumeError(Type.takeError());
+        consumeError(Name.takeError());
+        consumeError(Sec.takeError());
+        consumeError(Addr.takeError());
+        continue;
+      }
+      if (*Type != object::SymbolRef::ST_Function || *Sec == Obj.section_end() || !Size)
+        continue;
+      uint64_t Load = L.getSectionLoadAddress(**Sec) + (*Addr - (*Sec)->getAddress());
+      record(*Name, Load, Size);
+    }
+    fflush(Out);
+  }
+
+  // JITLink: 所有fixup完成后调用 进程内的JIT中此时代码已经位于目标地址
+  void notifyLinkGraph(jitlink::LinkGraph &G) {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    for (auto *Sym : G.defined_symbols())
+      if (Sym->hasName() && Sym->isCallable() && Sym->getSize())
+        record(Sym->getName(), Sym->getAddress().getValue(), Sym->getSize());
+    fflush(Out);
+  }
+
+private:
+  // jitdump文件格式 见linux源码中的tools/perf/Documentation/jitdump-specification.txt
+  struct JitDumpHeader {
+    uint32_t Magic = 0x4A695444;
+    uint32_t Version = 1;
+    uint32_t TotalSize = sizeof(JitDumpHeader);
+    uint32_t ElfMach;
+    uint32_t Pad1 = 0;
+    uint32_t Pid;
+    uint64_t Timestamp;
+    uint64_t Flags = 0;
+  };
+  struct JitDumpCodeLoad {
+    uint32_t Id = 0; // JIT_CODE_LOAD
+    uint32_t TotalSize;
+    uint64_t Timestamp;
+    uint32_t Pid;
+    uint32_t Tid;
+    uint64_t Vma;
+    uint64_t CodeAddr;
+    uint64_t CodeSize;
+    uint64_t CodeIndex;
+  };
+
+  explicit HoshinoPerfMap(PerfSupport Mode) : JitDump(Mode == PerfSupport::JitDump) {
+    Path = (JitDump ? "/tmp/jit-" : "/tmp/perf-") + std::to_string(getpid()) +
+           (JitDump ? ".dump" : ".map");
+    if (!JitDump) {
+      // 截断同pid的旧进程留下的map 否则perf会混入过时的符号
+      Out = fopen(Path.c_str(), "w");
+      return;
+    }
+    int Fd = open(Path.c_str(), O_CREAT | O_TRUNC | O_RDWR, 0666);
+    if (Fd < 0)
+      return;
+    // perf record通过这个可执行的mmap记录找到jitdump文件
+    Marker = mmap(nullptr, getpagesize(), PROT_READ | PROT_EXEC, MAP_PRIVATE, Fd, 0);
+    if (Marker == MAP_FAILED) {
+      Marker = nullptr;
+      close(Fd);
+      return;
+    }
+    Out = fdopen(Fd, "w");
+    JitDumpHeader Header;
+#if defined(__aarch64__)
+    Header.ElfMach = ELF::EM_AARCH64;
+#else
+    Header.ElfMach = ELF::EM_X86_64;
+#endif
+    Header.Pid = getpid();
+    Header.Timestamp = now();
+    fwrite(&Header, sizeof(Header), 1, Out);
+  }
+
+  void record(StringRef Symbol, uint64_t Addr, uint64_t Size) {
+    std::string Name = Symbol.str();
+    auto Loc = sourceLocations.Lookup({Symbol.data(), Symbol.size()});
+    if (Loc.line)
+      Name += " (" + Loc.ToString() + ")";
+    if (!JitDump) {
+      fprintf(Out, "%llx %llx %s\n", (unsigned long long)Addr, (unsigned long long)Size,
+              Name.c_str());
+      return;
+    }
+    JitDumpCodeLoad Load;
+    Load.TotalSize = sizeof(Load) + Name.size() + 1 + Size;
+    Load.Timestamp = now();
+    Load.Pid = getpid();
+    Load.Tid = syscall(SYS_gettid);
+    Load.Vma = Load.CodeAddr = Addr;
+    Load.CodeSize = Size;
+    Load.CodeIndex = NextCodeIndex++;
+    fwrite(&Load, sizeof(Load), 1, Out);
+    fwrite(Name.c_str(), Name.size() + 1, 1, Out);
+    fwrite(reinterpret_cast<const void *>(Addr), Size, 1, Out);
+  }
+
+  // perf record -k mono 使用CLOCK_MONOTONIC
+  static uint64_t now() {
+    timespec TS;
+    clock_gettime(CLOCK_MONOTONIC, &TS);
+    return TS.tv_sec * 1000000000ull + TS.tv_nsec;
+  }
+
+  bool JitDump;
+  std::string Path;
+  FILE *Out = nullptr;
+  void *Marker = nullptr;
+  std::mutex Mutex;
+  uint64_t NextCodeIndex = 0;
+};
+
+// JITLink(ObjectLinkingLayer)的插件 在链接完成后把LinkGraph中的函数交给HoshinoPerfMap
+class HoshinoPerfMapPlugin : public ObjectLinkingLayer::Plugin {
+public:
+  explicit HoshinoPerfMapPlugin(HoshinoPerfMap &Map) : Map(Map) {}
+
+  void modifyPassConfig(MaterializationResponsibility &MR, jitlink::LinkGraph &G,
+                        jitlink::PassConfiguration &Config) override {
+    Config.PostFixupPasses.push_back([this](jitlink::LinkGraph &G) {
+      Map.notifyLinkGraph(G);
+      return Error::success();
+    });
+  }
+
+  Error notifyFailed(MaterializationResponsibility &MR) override {
+    return Error::success();
+  }
+  Error notifyRemovingResources(ResourceKey K) override {
+    return Error::success();
+  }
+  void notifyTransferringResources(ResourceKey DstKey,
+                                   ResourceKey SrcKey) override {}
+
+private:
+  HoshinoPerfMap &Map;
+};
+
+} // end namespace orc
+} // end namespace llvm
@@ -0,0 +1,169 @@
+// HoshinoReclaimer
+#pragma once
+
+#include "llvm/ExecutionEngine/Orc/Core.h"
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace llvm {
+namespace orc {
+
+/*
+  记录每个函数定义的ResourceTracker 并按可达性回收不再使用的代码
+  =================================================================
+  每个函数定义有两个ResourceTracker：
+    StubRT 外层JITDylib中的惰性stub(lazy reexport)
+    BodyRT "<name>.impl"中的函数体 编译出的代码与数据归属于它
+  根(root)为仍然在函数注册表(functionProtos)中的定义 即之后的代码还能按名字调用的函数
+  从根出发沿静态调用图可达的定义都要保留 已经编译好的调用者会直接跳转到它们的stub
+  其余的定义(被undef)即为不可达 移除它们的两个ResourceTracker即可释放内存
+  函数被重新定义时stub保留 旧的函数体被新的取代 不再被任何代码引用 同样在回收时释放
+  =================================================================
+*/
+class HoshinoReclaimer {
+public:
+  struct Definition {
+    ResourceTrackerSP StubRT;
+    ResourceTrackerSP BodyRT;
+    bool Rooted = true;
+    // 被重新定义取代的旧函数体
+    std::vector<ResourceTrackerSP> Superseded;
+  };
+
+  // 被回收的定义 由调用者移除其ResourceTracker 只回收被取代的函数体时StubRT为空
+  struct Reclaimed {
+    std::string Name;
+    ResourceTrackerSP StubRT;
+    ResourceTrackerSP BodyRT;
+  };
+
+  using CalleesFn = std::function<std::set<std::string>(const std::string &)>;
+
+  void addDefinition(const std::string &DylibName, const std::string &Name,
+                     ResourceTrackerSP StubRT, ResourceTrackerSP BodyRT) {
+    std::lock_guard<std::mutex> Lock(ReclaimMutex);
+    Dylibs[DylibName][Name] = {std::move(StubRT), std::move(BodyRT), true, {}};
+  }
+
+  // 该dylib中是否还保留着名为Name的定义(可能已经不是根 但仍被调用者引用)
+  bool isDefined(const std::string &DylibName, const std::string &Name) const {
+    std::lock_guard<std::mutex> Lock(ReclaimMutex);
+    auto D = Dylibs.find(DylibName);
+    return D != Dylibs.end() && D->second.count(Name);
+  }
+
+  // 函数被重新定义 新的函数体取代旧的 重新成为根
+  void replaceBody(const std::string &DylibName, const std::string &Name,
+                   ResourceTrackerSP BodyRT) {
+    std::lock_guard<std::mutex> Lock(ReclaimMutex);
+    auto &Def = Dylibs[DylibName][Name];
+    if (Def.BodyRT) {
+      Def.Superseded.push_back(std::move(Def.BodyRT));
+      ++PendingUnrooted;
+    }
+    Def.BodyRT = std::move(BodyRT);
+    Def.Rooted = true;
+  }
+
+  // 函数不再能按名字调用 它是否被回收取决于是否还有可达的调用者
+  bool unroot(const std::string &DylibName, const std::string &Name) {
+    std::lock_guard<std::mutex> Lock(ReclaimMutex);
+    auto D = Dylibs.find(DylibName);
+    if (D == Dylibs.end())
+      return false;
+    auto It = D->second.find(Name);
+    if (It == D->second.end() || !It->second.Rooted)
+      return false;
+    It->second.Rooted = false;
+    ++PendingUnrooted;
+    return true;
+  }
+
+  // 找出DylibName中从根不可达的定义 把它们从记录中移除并返回
+  std::vector<Reclaimed> collect(const std::string &DylibName,
+                                 const CalleesFn &Callees) {
+    std::lock_guard<std::mutex> Lock(ReclaimMutex);
+    std::vector<Reclaimed> Result;
+    auto D = Dylibs.find(DylibName);
+    if (D == Dylibs.end())
+      return Result;
+    auto &Defs = D->second;
+    std::set<std::string> Live;
+    std::vector<std::string> Worklist;
+    for (auto &[Name, Def] : Defs)
+      if (Def.Rooted)
+        Worklist.push_back(Name);
+    while (!Worklist.empty()) {
+      auto Name = std::move(Worklist.back());
+      Worklist.pop_back();
+      if (!Live.insert(Name).second)
+        continue;
+      // 不在本dylib中的callee(prelude、extern函数)不参与回收
+      for (auto &Callee : Callees(Name))
+        if (Defs.count(Callee) && !Live.count(Callee))
+          Worklist.push_back(Callee);
+    }
+    for (auto It = Defs.begin(); It != Defs.end();) {
+      for (auto &RT : It->second.Superseded)
+        Result.push_back({It->first, nullptr, std::move(RT)});
+      It->second.Superseded.clear();
+      if (Live.count(It->first)) {
+        ++It;
+        continue;
+      }
+      Result.push_back({It->first, std::move(It->second.StubRT),
+                        std::move(It->second.BodyRT)});
+      It = Defs.erase(It);
+    }
+    PendingUnrooted = 0;
+    ReclaimedDefinitions += Result.size();
+    return Result;
+  }
+
+  // JITDylib被整个清空时丢弃它的记录
+  void removeDylib(const std::string &DylibName) {
+    std::lock_guard<std::mutex> Lock(ReclaimMutex);
+    Dylibs.erase(DylibName);
+  }
+
+  size_t getPendingUnrooted() const {
+    std::lock_guard<std::mutex> Lock(ReclaimMutex);
+    return PendingUnrooted;
+  }
+
+  size_t getReclaimedDefinitions() const {
+    std::lock_guard<std::mutex> Lock(ReclaimMutex);
+    return ReclaimedDefinitions;
+  }
+
+  size_t getLiveDefinitions() const {
+    std::lock_guard<std::mutex> Lock(ReclaimMutex);
+    size_t N = 0;
+    for (auto &[Name, Defs] : Dylibs)
+      N += Defs.size();
+    return N;
+  }
+
+  // 对每个记录的定义调用Fn(dylib名, 函数名, 定义) 调用期间持有锁
+  template <typename FnT> void forEachDefinition(FnT &&Fn) const {
+    std::lock_guard<std::mutex> Lock(ReclaimMutex);
+    for (auto &[DylibName, Defs] : Dylibs)
+      for (auto &[Name, Def] : Defs)
+        Fn(DylibName, Name, Def);
+  }
+
+private:
+  mutable std::mutex ReclaimMutex;
+  // JITDylib名称 -> 函数名 -> 定义
+  std::map<std::string, std::map<std::string, Definition>> Dylibs;
+  // 上次回收之后新变为非根的定义数
+  size_t PendingUnrooted = 0;
+  size_t ReclaimedDefinitions = 0;
+};
+
+} // end namespace orc
+} // end namespace llvm
@@ -0,0 +1,120 @@
+// HoshinoSpeculator
+#pragma once
+
+#include "llvm/ExecutionEngine/Orc/Core.h"
+#include "llvm/ExecutionEngine/Orc/Mangling.h"
+#include "llvm/Support/Error.h"
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <utility>
+
+namespace llvm {
+namespace orc {
+
+/*
+  推测编译(speculative compilation)
+  CompileOnDemandLayer是惰性编译的 每个函数第一次被调用时才会经过优化和编译
+  对于很深的调用链 冷启动时每一层都要停下来等待编译
+  这里利用codegen时从CallExprAST以及binary@/unary@运算符调用收集到的静态调用图：
+  当某个函数第一次被编译时 将它可能调用的函数(callee)交给后台线程提前编译
+  被推测编译的函数在编译时又会触发它自己的callee 于是整条调用链都会被预热
+  =================================================================
+  调用图按函数所在的JITDylib分开保存 守护进程模式下每个程序有自己的JITDylib
+  程序结束时通过removeDylib丢弃它的调用图
+*/
+class HoshinoSpeculator {
+private:
+  ExecutionSession &ES;
+  MangleAndInterner &Mangle;
+  std::mutex SpecMutex;
+  struct DylibGraph {
+    // 静态调用图 函数名 -> 该函数体中调用到的函数名
+    std::map<std::string, std::set<std::string>> CallGraph;
+    // 已经提交过推测编译的函数 每个函数只推测一次
+    std::set<std::string> Speculated;
+  };
+  // JITDylib名称 -> 该dylib中函数的调用图
+  std::map<std::string, DylibGraph> Graphs;
+
+public:
+  HoshinoSpeculator(ExecutionSession &ES, MangleAndInterner &Mangle)
+      : ES(ES), Mangle(Mangle) {}
+
+  // 函数定义加入JIT后注册它的callee
+  void registerCallees(const std::string &DylibName, const std::string &FuncName,
+                       std::set<std::string> Callees) {
+    std::lock_guard<std::mutex> Lock(SpecMutex);
+    Graphs[DylibName].CallGraph[FuncName] = std::move(Callees);
+  }
+
+  // 函数(比如顶层表达式的匿名函数)从JIT中移除后 同时移除它在调用图中的记录
+  void unregister(const std::string &DylibName, const std::string &FuncName) {
+    std::lock_guard<std::mutex> Lock(SpecMutex);
+    auto It = Graphs.find(DylibName);
+    if (It == Graphs.end())
+      return;
+    It->second.CallGraph.erase(FuncName);
+    It->second.Speculated.erase(FuncName);
+  }
+
+  // 函数体中静态调用到的函数 代码回收时用于计算可达性
+  std::set<std::string> getCallees(const std::string &DylibName,
+                                   const std::string &FuncName) {
+    std::lock_guard<std::mutex> Lock(SpecMutex);
+    auto G = Graphs.find(DylibName);
+    if (G == Graphs.end())
+      return {};
+    auto It = G->second.CallGraph.find(FuncName);
+    return It == G->second.CallGraph.end() ? std::set<std::string>{} : It->second;
+  }
+
+  // JITDylib被清空时丢弃它的整个调用图
+  void removeDylib(const std::string &DylibName) {
+    std::lock_guard<std::mutex> Lock(SpecMutex);
+    Graphs.erase(DylibName);
+  }
+
+  /*
+    在FuncName第一次被编译时调用 为它的callee发起异步lookup
+    CompileOnDemandLayer会为每个JITDylib创建一个名为"<name>.impl"的JITDylib保存函数体
+    在impl dylib中lookup一个符号才会真正触发该函数的编译 (在外层dylib中lookup只会得到stub)
+    因此SearchOrder应当是callee可能所在的impl dylib
+    lookup的materialization由ExecutionSession的TaskDispatcher分发到后台线程
+    这里不等待结果 callee不在SearchOrder中(比如extern函数)时被弱引用忽略
+  */
+  void speculateFor(const std::string &DylibName, StringRef FuncName,
+                    JITDylibSearchOrder SearchOrder) {
+    SymbolLookupSet Targets;
+    {
+      std::lock_guard<std::mutex> Lock(SpecMutex);
+      auto G = Graphs.find(DylibName);
+      if (G == Graphs.end())
+        return;
+      auto It = G->second.CallGraph.find(FuncName.str());
+      if (It == G->second.CallGraph.end())
+        return;
+      for (auto &Callee : It->second) {
+        // 自递归不需要推测
+        if (Callee == It->first)
+          continue;
+        if (!G->second.Speculated.insert(Callee).second)
+          continue;
+        Targets.add(Mangle(Callee), SymbolLookupFlags::WeaklyReferencedSymbol);
+      }
+    }
+    if (Targets.empty() || SearchOrder.empty())
+      return;
+    ES.lookup(
+        LookupKind::Static, SearchOrder, std::move(Targets), SymbolState::Ready,
+        [](Expected<SymbolMap> Result) {
+          if (!Result)
+            consumeError(Result.takeError());
+        },
+        NoDependenciesToRegister);
+  }
+};
+
+} // end namespace orc
+} // end namespace llvm
@@ -0,0 +1,72 @@
+// HoshinoTimeReport
+#pragma once
+
+#include "llvm/ExecutionEngine/Orc/Core.h"
+#include "llvm/ExecutionEngine/Orc/IRCompileLayer.h"
+#include "llvm/ExecutionEngine/Orc/Layer.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "tools/time_report.h"
+#include <memory>
+#include <string>
+
+namespace llvm {
+namespace orc {
+
+/*
+  --time-report在JIT各层中的统计 统计按定义归类:
+  module按其中第一个(非internal、非available_externally)的函数 object按第一个符号
+*/
+inline std::string getDefinitionName(const Module &M) {
+  for (auto &F : M)
+    if (!F.isDeclarationForLinker() && !F.hasLocalLinkage())
+      return F.getName().str();
+  return M.getModuleIdentifier();
+}
+
+inline std::string getDefinitionName(const MaterializationResponsibility &R) {
+  for (auto &KV : R.getSymbols())
+    return (*KV.first).str();
+  return {};
+}
+
+// 包装IRCompiler 统计IR生成object(指令选择、寄存器分配等)所用的时间与object的大小
+class HoshinoTimedCompiler : public IRCompileLayer::IRCompiler {
+public:
+  explicit HoshinoTimedCompiler(std::unique_ptr<IRCompiler> Inner)
+      : IRCompiler(Inner->getManglingOptions()), Inner(std::move(Inner)) {}
+
+  Expected<std::unique_ptr<MemoryBuffer>> operator()(Module &M) override {
+    PhaseTimer Timer(Phase::EmitObject, getDefinitionName(M));
+    auto Obj = (*Inner)(M);
+    if (Obj)
+      Timer.AddBytes((*Obj)->getBufferSize());
+    return Obj;
+  }
+
+private:
+  std::unique_ptr<IRCompiler> Inner;
+};
+
+/*
+  位于IRCompileLayer与真正的object层之间 统计链接(解析object、分配内存、重定位)的时间
+  符号解析可能要等待其他定义编译完成 这部分在回调中异步进行 不计入此处
+  加载的字节数由HoshinoCodeStats记录
+*/
+class HoshinoTimedObjectLayer : public ObjectLayer {
+public:
+  HoshinoTimedObjectLayer(ExecutionSession &ES, ObjectLayer &Base)
+      : ObjectLayer(ES), Base(Base) {}
+
+  void emit(std::unique_ptr<MaterializationResponsibility> R,
+            std::unique_ptr<MemoryBuffer> O) override {
+    PhaseTimer Timer(Phase::Link, getDefinitionName(*R));
+    Base.emit(std::move(R), std::move(O));
+  }
+
+private:
+  ObjectLayer &Base;
+};
+
+} // end namespace orc
+} // end namespace llvm
@@ -22,6 +22,13 @@ enum TokenNum{
     TOK_VAR = -12,
     TOK_EXPR_END = -13,
     TOK_STR = -14,
+    TOK_UNDEF = -15,
+    TOK_PURE = -16,
+    TOK_PARFOR = -17,
+    TOK_SPAWN = -18,
+    TOK_AWAIT = -19,
+    TOK_SYNC = -20,
+    TOK_IMPORT = -21,
 };
 
 class Token{
@@ -46,11 +53,11 @@ public:
 };
 
 
-inline std::string identifierStr;
-inline double numVal;
-inline Token curTok;
-inline std::unordered_map<std::string, int>binOpPrecedence;
-inline std::unordered_set<std::string>validBinOp;
+inline thread_local std::string identifierStr;
+inline thread_local double numVal;
+inline thread_local Token curTok;
+inline thread_local std::unordered_map<std::string, int>binOpPrecedence;
+inline thread_local std::unordered_set<std::string>validBinOp;
 
 inline void InitBinOpPrecedence(){
     binOpPrecedence["="] = 2;
@@ -103,9 +110,17 @@ constexpr const char* anonymous_expr_name = "__anon_expr";
 
 // extern 
 extern int GetNextToken();
+// curTok在源码中的行号(从1开始)
+extern unsigned GetTokenLine();
+// 切换sourceInput后重置词法分析器的状态
+extern void ResetLexer();
 extern std::unique_ptr<hoshino::FunctionAST> ParseTopLevelExpr(std::string&);
 extern std::unique_ptr<hoshino::FunctionAST>ParseDefinition();
 extern std::unique_ptr<hoshino::PrototypeAST> ParseExtern();
+// undef name | undef unary@op | undef binary@op 返回函数名 出错时返回空字符串
+extern std::string ParseUndef();
+// import "path" 返回库的路径 出错时返回空字符串
+extern std::string ParseImport();
 
 
 
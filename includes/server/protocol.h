@@ -0,0 +1,108 @@
+#pragma once
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/*
+    hoshino守护进程(hoshino --daemon)与客户端(hoshino-client)之间的unix domain socket协议
+    =================================================================
+    请求(客户端 -> 守护进程)：
+        "HSN1" | u32 length | length字节的脚本源码
+    响应(守护进程 -> 客户端) 由若干帧组成：
+        u8 type | u32 length | length字节的数据
+        type == 'O': 程序的输出(原本写到stdout/stderr的内容)
+        type == 'X': 程序结束 数据为u32的退出状态 之后守护进程关闭连接
+    所有整数均为网络字节序
+    =================================================================
+*/
+namespace hoshino::server {
+
+constexpr const char protocolMagic[4] = {'H', 'S', 'N', '1'};
+constexpr char frameOutput = 'O';
+constexpr char frameExit = 'X';
+// 单个脚本的大小上限 防止异常的请求耗尽守护进程的内存
+constexpr uint32_t maxSourceSize = 64u * 1024 * 1024;
+
+inline std::string DefaultSocketPath(){
+    return "/tmp/hoshino-" + std::to_string(getuid()) + ".sock";
+}
+
+inline bool WriteAll(int fd, const void *data, size_t len){
+    auto p = static_cast<const char*>(data);
+    while(len){
+        ssize_t n = ::write(fd, p, len);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+inline bool ReadAll(int fd, void *data, size_t len){
+    auto p = static_cast<char*>(data);
+    while(len){
+        ssize_t n = ::read(fd, p, len);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+inline bool WriteFrame(int fd, char type, const void *data, uint32_t len){
+    char header[5];
+    header[0] = type;
+    uint32_t netLen = htonl(len);
+    std::memcpy(header + 1, &netLen, 4);
+    return WriteAll(fd, header, sizeof(header)) && WriteAll(fd, data, len);
+}
+
+inline bool ReadFrame(int fd, char&type, std::string&data){
+    char header[5];
+    if(!ReadAll(fd, header, sizeof(header)))
+        return false;
+    type = header[0];
+    uint32_t netLen;
+    std::memcpy(&netLen, header + 1, 4);
+    data.resize(ntohl(netLen));
+    return ReadAll(fd, data.data(), data.size());
+}
+
+inline bool WriteRequest(int fd, const std::string&source){
+    uint32_t netLen = htonl(static_cast<uint32_t>(source.size()));
+    return WriteAll(fd, protocolMagic, 4) && WriteAll(fd, &netLen, 4) &&
+           WriteAll(fd, source.data(), source.size());
+}
+
+inline bool ReadRequest(int fd, std::string&source){
+    char magic[4];
+    uint32_t netLen;
+    if(!ReadAll(fd, magic, 4) || std::memcmp(magic, protocolMagic, 4) != 0)
+        return false;
+    if(!ReadAll(fd, &netLen, 4) || ntohl(netLen) > maxSourceSize)
+        return false;
+    source.resize(ntohl(netLen));
+    return ReadAll(fd, source.data(), source.size());
+}
+
+inline bool FillSocketAddr(const std::string&path, sockaddr_un&addr){
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(path.size() >= sizeof(addr.sun_path))
+        return false;
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    return true;
+}
+
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+/*
+    编译服务器(hoshino --daemon)
+    常驻进程只初始化一次LLVM与JIT(以及可选的prelude) 通过unix domain socket接收脚本并执行
+    避免每次运行脚本都重新付出进程启动、target初始化与运算符定义编译的开销
+    每个提交的脚本在自己的线程与JITDylib中编译运行 多个脚本可以同时运行
+    它们共享prelude dylib中已编译好的代码 输出转发给客户端 结束后该JITDylib被清空
+*/
+extern int RunServer();
@@ -4,13 +4,42 @@
 #include <cstdio>
 #include <llvm-14/llvm/ADT/StringRef.h>
 #include <llvm/IR/Value.h>
+#include <llvm/Support/raw_ostream.h>
 #include <memory>
 #include <mutex>
 
 
+// 已报告的错误数 守护进程模式下用于决定程序的退出状态
+inline thread_local int errorCount = 0;
+
+/*
+    前端的诊断信息与顶层表达式的求值结果写到diagOutput
+    普通模式下为stderr 守护进程中每个程序线程把它指向自己客户端的连接
+*/
+inline thread_local FILE *diagOutput = stderr;
+
+// 写到diagOutput的llvm::raw_ostream 用于打印IR与llvm::Error
+class DiagOStream : public llvm::raw_ostream {
+public:
+    DiagOStream(){ SetUnbuffered(); }
+private:
+    void write_impl(const char *ptr, size_t size) override {
+        fwrite(ptr, 1, size, diagOutput);
+        pos_ += size;
+    }
+    uint64_t current_pos() const override { return pos_; }
+    uint64_t pos_ = 0;
+};
+
+inline auto diags() -> llvm::raw_ostream& {
+    static thread_local DiagOStream os;
+    return os;
+}
+
 inline auto log_err(const char *str) -> std::unique_ptr<hoshino::ExprAST>{ 
-    fprintf(stderr, "Error: %s\n", str); 
-    fflush(stderr);
+    ++errorCount;
+    fprintf(diagOutput, "Error: %s\n", str); 
+    fflush(diagOutput);
     return nullptr; 
 }
 
@@ -3,11 +3,19 @@
 #include <llvm-14/llvm/IR/IRBuilder.h>
 #include <llvm-14/llvm/IR/Instructions.h>
 #include <llvm-14/llvm/IR/Type.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/Linker/Linker.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
 #include <string>
 #include <string_view>
+#include <vector>
 #include "code_gen/ir.h"
+#include "tools/options.h"
 
-inline std::unique_ptr<hoshino::CodeGenVisitor>codeGenerator;
+inline thread_local std::unique_ptr<hoshino::CodeGenVisitor>codeGenerator;
 inline void InitCodeVisitor(){
     codeGenerator = std::make_unique<hoshino::CodeGenVisitor>();
 }
@@ -21,6 +29,130 @@ inline auto getFunction(std::string_view name) -> llvm::Function* {
         return it->second->ToLLvmValue(codeGenerator.get());
     return nullptr;
 }
+
+/*
+    运算符定义完成后(交给JIT之前)保存其所在module的bitcode 重新定义时覆盖旧的函数体
+    只在增量的JIT模式下保存 AOT与整体编译模式下所有函数本来就在同一个module中
+*/
+inline void SaveOperatorBody(const std::string &name){
+    if(!theJIT || hoshinoOptions.wholeProgram || !hoshinoOptions.inlineOperators)
+        return;
+    std::string bitcode;
+    llvm::raw_string_ostream os{bitcode};
+    llvm::WriteBitcodeToFile(*theModule, os);
+    os.flush();
+    operatorBodies[name] = std::move(bitcode);
+}
+
+/*
+    定义name交给JIT之前记录当前module中复制进来的运算符函数体 并保存module的bitcode
+    这些运算符重新定义时 用保存的bitcode重新生成该定义
+*/
+inline void SaveInlinerBody(const std::string &name){
+    if(!theJIT || hoshinoOptions.wholeProgram || !hoshinoOptions.inlineOperators)
+        return;
+    std::vector<std::string> inlined;
+    for(auto &F : *theModule)
+        if(F.hasAvailableExternallyLinkage())
+            inlined.push_back(F.getName().str());
+    if(inlined.empty()){
+        inlinerBodies.erase(name);
+        return;
+    }
+    std::string bitcode;
+    llvm::raw_string_ostream os{bitcode};
+    llvm::WriteBitcodeToFile(*theModule, os);
+    os.flush();
+    inlinerBodies[name] = std::move(bitcode);
+    for(auto &op : inlined)
+        operatorInliners[op].insert(name);
+}
+
+/*
+    把运算符name的函数体以available_externally的形式复制到当前module中
+    函数体中调用的其他运算符也一并复制 链接会替换掉原来的声明 所以之前取得的Function*会失效
+*/
+inline void ImportOperatorBody(const std::string &name){
+    auto it = operatorBodies.find(name);
+    if(it == operatorBodies.end())
+        return;
+    auto buffer = llvm::MemoryBuffer::getMemBuffer(it->second, name, false);
+    auto mod = llvm::parseBitcodeFile(buffer->getMemBufferRef(), *theContext);
+    if(!mod){
+        llvm::consumeError(mod.takeError());
+        return;
+    }
+    // 只保留该运算符本身 (保存时一起复制进来的)其他运算符的函数体改为声明
+    std::vector<std::string> callees;
+    for(auto &F : **mod){
+        if(F.isDeclaration())
+            continue;
+        if(F.getName() != name){
+            F.deleteBody();
+            continue;
+        }
+        F.setLinkage(llvm::GlobalValue::AvailableExternallyLinkage);
+        F.addFnAttr(llvm::Attribute::AlwaysInline);
+        for(auto &inst : llvm::instructions(F))
+            if(auto *call = llvm::dyn_cast<llvm::CallInst>(&inst))
+                if(auto *callee = call->getCalledFunction())
+                    callees.push_back(callee->getName().str());
+    }
+    if(llvm::Linker::linkModules(*theModule, std::move(*mod)))
+        return;
+    for(auto &callee : callees)
+        if(auto *func = theModule->getFunction(callee); func && func->isDeclaration())
+            ImportOperatorBody(callee);
+}
+
+/*
+    取得运算符的函数 并复制其函数体供内联
+    正在定义的运算符(递归调用自身)不复制 否则会覆盖正在生成的函数体
+*/
+inline auto getOperatorFunction(const std::string &name) -> llvm::Function* {
+    auto *func = getFunction(name);
+    if(!func || !func->isDeclaration() || !operatorBodies.count(name))
+        return func;
+    if(auto *block = builder->GetInsertBlock(); block && block->getParent()->getName() == name)
+        return func;
+    ImportOperatorBody(name);
+    return theModule->getFunction(name);
+}
+/*
+    pure函数的memo表名 JIT中加上所在JITDylib的名字 
+    守护进程中同时运行的程序即使有同名的函数也不会共用一张表
+*/
+inline auto MemoTableName(const std::string &name) -> std::string {
+    if(!theJIT)
+        return name;
+    return theJIT->getCurrentJITDylib().getName() + "/" + name;
+}
+
+/*
+    直接或间接调用了name(或本身就是name)的pure函数
+    name被重新定义后这些函数缓存的结果都不再可信
+*/
+inline auto MemoFunctionsDependingOn(const std::string &name) -> std::vector<std::string> {
+    std::vector<std::string> result;
+    for(auto &memo : memoFunctions){
+        std::set<std::string> visited;
+        std::vector<std::string> work{memo};
+        while(!work.empty()){
+            auto fn = std::move(work.back());
+            work.pop_back();
+            if(fn == name){
+                result.push_back(memo);
+                break;
+            }
+            auto it = sideEffectFree.find(fn);
+            if(!visited.insert(fn).second || it == sideEffectFree.end())
+                continue;
+            work.insert(work.end(), it->second.begin(), it->second.end());
+        }
+    }
+    return result;
+}
+
 /*
     在theFunc的开头处建立一个名为varName的alloca变量
 */
@@ -0,0 +1,146 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <unistd.h>
+#include <unordered_map>
+#include <llvm/IR/DiagnosticHandler.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+
+/*
+    --mem-report / --mem-limit: 统计前端与JIT各部分占用的内存
+    AST: AST节点通过类的operator new/delete计数 总是开启(只有两次relaxed的原子加法)
+    LLVMContext/Module: 每个context只有一个module(InitModuleAndManager) 交给JIT之后
+        惰性编译的函数体在第一次调用之前一直保留着IR 编译完成或被移除后context才析构
+        context的析构通过安装在其上的DiagnosticHandler(由context持有)得知 只在开启时安装
+    JIT的代码与数据由HoshinoCodeStats按ResourceTracker统计
+*/
+class MemoryAccounting {
+public:
+    struct ASTStats {
+        size_t nodes = 0;
+        size_t bytes = 0;
+        size_t peakBytes = 0;
+        size_t allocated = 0; // 累计分配的节点数
+    };
+
+    struct ContextStats {
+        size_t live = 0;
+        size_t instructions = 0; // 交给JIT时的IR指令数之和
+        size_t peakLive = 0;
+        size_t created = 0;
+    };
+
+    void Enable(){ enabled_ = true; }
+    bool Enabled() const { return enabled_; }
+
+    void ASTAllocated(size_t bytes){
+        astNodes_.fetch_add(1, std::memory_order_relaxed);
+        astAllocated_.fetch_add(1, std::memory_order_relaxed);
+        size_t now = astBytes_.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+        size_t peak = astPeakBytes_.load(std::memory_order_relaxed);
+        while(now > peak && !astPeakBytes_.compare_exchange_weak(peak, now, std::memory_order_relaxed))
+            ;
+    }
+    void ASTReleased(size_t bytes){
+        astNodes_.fetch_sub(1, std::memory_order_relaxed);
+        astBytes_.fetch_sub(bytes, std::memory_order_relaxed);
+    }
+    ASTStats GetASTStats() const {
+        return {astNodes_.load(std::memory_order_relaxed), astBytes_.load(std::memory_order_relaxed),
+            astPeakBytes_.load(std::memory_order_relaxed), astAllocated_.load(std::memory_order_relaxed)};
+    }
+
+    // 新建的context 未开启时什么也不做
+    void TrackContext(llvm::LLVMContext &context){
+        if(!enabled_)
+            return;
+        {
+            std::lock_guard<std::mutex> lock{mutex_};
+            contexts_[&context] = 0;
+            ++created_;
+            peakLive_ = std::max(peakLive_, contexts_.size());
+        }
+        context.setDiagnosticHandler(std::make_unique<ContextTracker>(*this, context));
+    }
+
+    // module交给JIT之前记录它的大小 之后module在编译线程中被优化 不能再去读取
+    void RecordModule(const llvm::Module &module){
+        if(!enabled_)
+            return;
+        size_t instructions = module.getInstructionCount();
+        std::lock_guard<std::mutex> lock{mutex_};
+        if(auto it = contexts_.find(&module.getContext()); it != contexts_.end())
+            it->second = instructions;
+    }
+
+    ContextStats GetContextStats() const {
+        std::lock_guard<std::mutex> lock{mutex_};
+        ContextStats stats;
+        stats.live = contexts_.size();
+        for(auto &[context, instructions] : contexts_)
+            stats.instructions += instructions;
+        stats.peakLive = peakLive_;
+        stats.created = created_;
+        return stats;
+    }
+
+    // 进程的常驻内存 读取失败时为0
+    static size_t ResidentBytes(){
+        FILE *statm = fopen("/proc/self/statm", "r");
+        if(!statm)
+            return 0;
+        unsigned long long size = 0, resident = 0;
+        int n = fscanf(statm, "%llu %llu", &size, &resident);
+        fclose(statm);
+        return n == 2 ? resident * sysconf(_SC_PAGESIZE) : 0;
+    }
+
+private:
+    // 默认的诊断处理 只用于得知context的析构 RemarkScope替换handler时会把它换回来
+    class ContextTracker : public llvm::DiagnosticHandler {
+    public:
+        ContextTracker(MemoryAccounting &accounting, llvm::LLVMContext &context)
+            : accounting_(accounting), context_(&context) {}
+        ~ContextTracker() override {
+            std::lock_guard<std::mutex> lock{accounting_.mutex_};
+            accounting_.contexts_.erase(context_);
+        }
+
+    private:
+        MemoryAccounting &accounting_;
+        llvm::LLVMContext *context_;
+    };
+
+    bool enabled_ = false;
+    std::atomic<size_t> astNodes_{0};
+    std::atomic<size_t> astBytes_{0};
+    std::atomic<size_t> astPeakBytes_{0};
+    std::atomic<size_t> astAllocated_{0};
+    mutable std::mutex mutex_;
+    // 存活的context -> 其中module的IR指令数
+    std::unordered_map<const llvm::LLVMContext*, size_t> contexts_;
+    size_t peakLive_ = 0;
+    size_t created_ = 0;
+};
+
+// 不析构: 编译线程与其他线程中的context可能在静态对象析构之后才析构
+inline MemoryAccounting &memoryAccounting = *new MemoryAccounting;
+
+// AST节点的基类 通过类的operator new/delete统计节点数与字节数(不含节点中string/vector另外分配的内存)
+struct CountedAST {
+    static void *operator new(size_t size){
+        memoryAccounting.ASTAllocated(size);
+        return ::operator new(size);
+    }
+    // 有虚析构函数时size为实际类型的大小
+    static void operator delete(void *ptr, size_t size){
+        memoryAccounting.ASTReleased(size);
+        ::operator delete(ptr);
+    }
+};
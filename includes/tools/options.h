@@ -0,0 +1,117 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+// 输出方式 JIT为默认的解释执行 Object/Executable为AOT编译
+enum class EmitMode {
+    JIT,
+    Object,     // --emit-obj
+    Executable, // --emit-exe
+};
+
+// 代码回收策略 --reclaim=explicit|auto
+enum class ReclaimPolicy {
+    Explicit,
+    Auto,
+};
+
+// 让perf识别JIT生成的函数 --perf=map|jitdump
+enum class PerfSupport {
+    None,
+    Map,     // /tmp/perf-<pid>.map
+    JitDump, // /tmp/jit-<pid>.dump 配合perf inject --jit
+};
+
+// --remarks输出的LLVM优化remark的种类 可以组合
+enum RemarkKind : unsigned {
+    RemarkPassed = 1,   // 完成的优化
+    RemarkMissed = 2,   // 没有完成的优化及原因
+    RemarkAnalysis = 4, // 分析的结果(比如代价模型)
+};
+
+/*
+    命令行选项
+    用法: hoshino [options] <source file>
+*/
+struct HoshinoOptions {
+    // 源文件
+    std::string sourceFile;
+    EmitMode emitMode = EmitMode::JIT;
+    // AOT编译的输出文件 -o指定 默认为源文件名去掉扩展名(exe)或换成.o(obj)
+    std::string outputFile;
+    // 使用JITLink(ObjectLinkingLayer)代替RuntimeDyld(RTDyldObjectLinkingLayer)链接object
+    bool useJITLink = false;
+    // 开启磁盘object缓存 第二次运行未修改的脚本时可以跳过codegen
+    bool objectCache = false;
+    // 缓存目录 为空时使用~/.cache/hoshino
+    std::string cacheDir;
+    // 缓存目录大小上限(MB) 超出时淘汰最久未访问的object
+    unsigned long long cacheSizeMB = 256;
+    // 守护进程模式 保持JIT常驻 通过unix domain socket接收脚本
+    bool daemon = false;
+    // 守护进程监听的socket路径 为空时使用/tmp/hoshino-<uid>.sock
+    std::string socketPath;
+    // 守护进程启动时加载到PreludeJD中的公共脚本(比如运算符定义) 所有提交的程序都可以使用
+    std::string preludeFile;
+    /*
+        代码回收策略 (undef的函数、被取代的定义 在没有可达的调用者时才会被回收)
+        Explicit: 只在执行undef语句时回收
+        Auto: 每个顶层定义/表达式之后自动回收
+    */
+    ReclaimPolicy reclaimPolicy = ReclaimPolicy::Explicit;
+    /*
+        整体编译模式 先解析整个源文件生成一个Module 经过过程间优化(内联等)后一次性交给JIT
+        顶层表达式在解析完成后按顺序执行 默认为增量的REPL模式
+    */
+    bool wholeProgram = false;
+    /*
+        增量模式下把运算符(binary@/unary@)的函数体复制到之后的module中内联
+        代价是重新定义运算符后 之前已经编译的调用者仍使用内联进去的旧函数体
+    */
+    bool inlineOperators = true;
+    // 每个def pure函数的memo表最多缓存的结果数 超出时淘汰最久未使用的结果
+    size_t memoSize = 65536;
+    // --output=stdout|stderr|FILE 内置函数(printNum、putchard等)的输出 为空时为stderr
+    std::string outputTarget;
+    /*
+        --time-report[=json] 退出前打印各阶段(lex、parse、codegen、优化、生成object、链接、执行)的统计
+        --time-report-file=PATH 把报告写到文件中 默认写到stderr
+    */
+    bool timeReport = false;
+    bool timeReportJSON = false;
+    std::string timeReportFile;
+    // --trace=FILE 退出时把编译流水线的时间线写成Chrome Trace Event JSON
+    std::string traceFile;
+    // --perf=map|jitdump 为perf记录每个加载的JIT函数的地址、大小与源码位置
+    PerfSupport perf = PerfSupport::None;
+    /*
+        --profile 在函数入口与返回处以及for循环中插入计数 退出前打印每个函数的调用次数、
+        inclusive/exclusive时间与循环次数 未开启时不生成任何额外的代码
+    */
+    bool profile = false;
+    /*
+        --remarks[=passed,missed,analysis] 收集优化pass的remark 退出时按定义分组打印 默认三种都收集
+        --remarks-format=text|yaml --remarks-file=PATH写到文件中(默认stderr)
+        --remarks-filter=REGEX 只收集pass名匹配的remark(比如inline|gvn)
+    */
+    unsigned remarkKinds = 0;
+    bool remarksYAML = false;
+    std::string remarksFile;
+    std::string remarksFilter;
+    // --mem-report 退出前打印AST、函数注册表、LLVMContext/Module与JIT代码/数据的内存统计
+    bool memReport = false;
+    /*
+        --mem-limit=MB 统计到的内存(JIT代码与数据、AST)的软上限 0为不限制
+        每个顶层定义/表达式之后检查 超出时警告(warn) 或先回收不可达的代码再检查(evict)
+    */
+    size_t memLimitMB = 0;
+    bool memLimitEvict = false;
+};
+
+inline HoshinoOptions hoshinoOptions;
+
+/*
+    解析命令行参数到hoshinoOptions中
+    遇到未知选项或没有指定源文件时打印用法并返回false
+*/
+extern bool ParseOptions(int argc, char* argv[]);
@@ -0,0 +1,218 @@
+#pragma once
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#include <llvm/IR/DiagnosticHandler.h>
+#include <llvm/IR/DiagnosticInfo.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/Support/Regex.h>
+#include "tools/options.h"
+#include "tools/source_locations.h"
+
+/*
+    --remarks: 收集LLVM优化pass的remark(例如没有内联的调用、没有消除的load、没有消除的尾调用)
+    只在运行优化pass期间(RemarkScope)在module的LLVMContext上安装handler 没有开启时不安装
+    remark中的函数名对应回Hoshino的定义: 去掉重新定义的版本号 位置为定义所在的行
+    退出时按定义分组打印 或者写成与opt -pass-remarks-output相同的YAML(可以用opt-viewer查看)
+*/
+class RemarkCollector {
+public:
+    // kinds为RemarkKind的组合 filter为pass名的正则表达式(为空时不过滤) 正则表达式不合法时返回false
+    bool Enable(unsigned kinds, const std::string &filter){
+        if(!filter.empty()){
+            filter_ = std::make_unique<llvm::Regex>(filter);
+            std::string error;
+            if(!filter_->isValid(error)){
+                fprintf(stderr, "Error: invalid --remarks-filter: %s\n", error.c_str());
+                return false;
+            }
+        }
+        kinds_ = kinds;
+        return true;
+    }
+    bool Enabled() const { return kinds_ != 0; }
+
+    void Print(FILE *out){
+        std::lock_guard<std::mutex> lock{mutex_};
+        size_t counts[3] = {};
+        for(auto &remark : remarks_)
+            ++counts[remark.kind];
+        fprintf(out, "===== optimization remarks: %zu passed, %zu missed, %zu analysis =====\n",
+            counts[Passed], counts[Missed], counts[Analysis]);
+        // 同一定义的remark打印在一起 按第一次出现的顺序
+        std::vector<std::string> order;
+        for(auto &remark : remarks_)
+            if(std::find(order.begin(), order.end(), remark.definition) == order.end())
+                order.push_back(remark.definition);
+        for(auto &definition : order){
+            bool first = true;
+            for(auto &remark : remarks_){
+                if(remark.definition != definition)
+                    continue;
+                if(first){
+                    fprintf(out, "%s", definition.c_str());
+                    if(remark.location.line)
+                        fprintf(out, " (%s)", remark.location.ToString().c_str());
+                    fprintf(out, ":\n");
+                    first = false;
+                }
+                fprintf(out, "  %-8s %-16s %s\n", KindName(remark.kind), remark.pass.c_str(),
+                    remark.message.c_str());
+            }
+        }
+    }
+
+    void PrintYAML(FILE *out){
+        static const char *tags[] = {"Passed", "Missed", "Analysis"};
+        std::lock_guard<std::mutex> lock{mutex_};
+        for(auto &remark : remarks_){
+            fprintf(out, "--- !%s\nPass:            ", tags[remark.kind]);
+            WriteYAMLString(out, remark.pass);
+            fprintf(out, "\nName:            ");
+            WriteYAMLString(out, remark.name);
+            if(remark.location.line){
+                fprintf(out, "\nDebugLoc:        { File: ");
+                WriteYAMLString(out, remark.location.file);
+                fprintf(out, ", Line: %u, Column: 0 }", remark.location.line);
+            }
+            fprintf(out, "\nFunction:        ");
+            WriteYAMLString(out, remark.function);
+            fprintf(out, "\nArgs:\n");
+            for(auto &[key, value] : remark.args){
+                fprintf(out, "  - ");
+                WriteYAMLString(out, key);
+                fprintf(out, ": ");
+                WriteYAMLString(out, value);
+                fprintf(out, "\n");
+            }
+            fprintf(out, "...\n");
+        }
+    }
+
+private:
+    friend class RemarkScope;
+
+    enum Kind { Passed, Missed, Analysis };
+
+    struct Remark {
+        Kind kind;
+        std::string pass;
+        std::string name;
+        std::string function;
+        std::string definition;
+        SourceLocation location;
+        std::string message;
+        std::vector<std::pair<std::string, std::string>> args;
+    };
+
+    class Handler : public llvm::DiagnosticHandler {
+    public:
+        explicit Handler(RemarkCollector &collector) : collector_(collector) {}
+
+        bool handleDiagnostics(const llvm::DiagnosticInfo &info) override {
+            auto *remark = llvm::dyn_cast<llvm::DiagnosticInfoOptimizationBase>(&info);
+            if(!remark)
+                return false;
+            collector_.Record(*remark);
+            return true;
+        }
+        bool isPassedOptRemarkEnabled(llvm::StringRef pass) const override {
+            return collector_.IsEnabled(RemarkPassed, pass);
+        }
+        bool isMissedOptRemarkEnabled(llvm::StringRef pass) const override {
+            return collector_.IsEnabled(RemarkMissed, pass);
+        }
+        bool isAnalysisRemarkEnabled(llvm::StringRef pass) const override {
+            return collector_.IsEnabled(RemarkAnalysis, pass);
+        }
+        bool isAnyRemarkEnabled() const override { return true; }
+
+    private:
+        RemarkCollector &collector_;
+    };
+
+    /*
+        pass manager在每个pass之后以"size-info"报告指令数的变化 数量很多
+        只有--remarks-filter明确匹配时才收集
+    */
+    bool IsEnabled(RemarkKind kind, llvm::StringRef pass) const {
+        if(!(kinds_ & kind))
+            return false;
+        if(!filter_)
+            return pass != "size-info";
+        return filter_->match(pass);
+    }
+
+    void Record(const llvm::DiagnosticInfoOptimizationBase &info){
+        Kind kind = info.isPassed() ? Passed : info.isMissed() ? Missed : Analysis;
+        if(!IsEnabled(kind == Passed ? RemarkPassed : kind == Missed ? RemarkMissed : RemarkAnalysis,
+            info.getPassName()))
+            return;
+        Remark remark;
+        remark.kind = kind;
+        remark.pass = info.getPassName().str();
+        remark.name = info.getRemarkName().str();
+        if(auto *located = llvm::dyn_cast<llvm::DiagnosticInfoWithLocationBase>(&info))
+            remark.function = located->getFunction().getName().str();
+        // 重新定义的函数体名为"<name>$<version>"
+        remark.definition = remark.function.substr(0, remark.function.find('$'));
+        remark.location = sourceLocations.Lookup(remark.function);
+        remark.message = info.getMsg();
+        for(auto &arg : info.getArgs())
+            remark.args.emplace_back(arg.Key, arg.Val);
+        std::lock_guard<std::mutex> lock{mutex_};
+        remarks_.push_back(std::move(remark));
+    }
+
+    static const char *KindName(Kind kind){
+        static const char *names[] = {"passed", "missed", "analysis"};
+        return names[kind];
+    }
+
+    static void WriteYAMLString(FILE *out, const std::string &str){
+        fputc('\'', out);
+        for(char c : str){
+            if(c == '\'')
+                fputc('\'', out);
+            fputc(c, out);
+        }
+        fputc('\'', out);
+    }
+
+    unsigned kinds_ = 0;
+    std::unique_ptr<llvm::Regex> filter_;
+    std::mutex mutex_;
+    std::vector<Remark> remarks_;
+};
+
+inline RemarkCollector remarkCollector;
+
+/*
+    在作用域内把context上的remark交给remarkCollector 作用域结束时恢复原先的handler
+    JIT中每个module有自己的LLVMContext 优化在编译线程中进行 所以每次优化都要安装
+*/
+class RemarkScope {
+public:
+    explicit RemarkScope(llvm::LLVMContext &context)
+        : context_(remarkCollector.Enabled() ? &context : nullptr) {
+        if(!context_)
+            return;
+        previous_ = context_->getDiagnosticHandler();
+        context_->setDiagnosticHandler(std::make_unique<RemarkCollector::Handler>(remarkCollector));
+    }
+    RemarkScope(const RemarkScope&) = delete;
+    RemarkScope &operator=(const RemarkScope&) = delete;
+    ~RemarkScope(){
+        if(context_)
+            context_->setDiagnosticHandler(std::move(previous_));
+    }
+
+private:
+    llvm::LLVMContext *context_;
+    std::unique_ptr<llvm::DiagnosticHandler> previous_;
+};
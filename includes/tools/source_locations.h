@@ -0,0 +1,49 @@
+#pragma once
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+struct SourceLocation {
+    std::string file;
+    // 0表示没有记录
+    unsigned line = 0;
+
+    std::string ToString() const {
+        return file + ":" + std::to_string(line);
+    }
+};
+
+/*
+    定义在源码中的位置 前端在把定义交给JIT之前记录
+    --perf与--remarks用它把LLVM中的函数对应回源码
+    同一定义生成的函数("<name>$<version>"、"<name>.parfor.N"、"<name>.spawn.N")共用定义的位置
+*/
+class SourceLocations {
+public:
+    void Enable(){ enabled_ = true; }
+    bool Enabled() const { return enabled_; }
+
+    void Set(const std::string &definition, SourceLocation location){
+        std::lock_guard<std::mutex> lock{mutex_};
+        locations_[definition] = std::move(location);
+    }
+
+    SourceLocation Lookup(std::string_view symbol){
+        std::lock_guard<std::mutex> lock{mutex_};
+        auto it = locations_.find(std::string{DefinitionOf(symbol)});
+        return it == locations_.end() ? SourceLocation{} : it->second;
+    }
+
+    // 标识符中不会出现'$'与'.' 它们之前的部分就是定义的名字
+    static std::string_view DefinitionOf(std::string_view symbol){
+        return symbol.substr(0, symbol.find_first_of("$."));
+    }
+
+private:
+    bool enabled_ = false;
+    std::mutex mutex_;
+    std::unordered_map<std::string, SourceLocation> locations_;
+};
+
+inline SourceLocations sourceLocations;
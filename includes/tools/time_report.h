@@ -0,0 +1,224 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include "tools/trace.h"
+
+/*
+    --time-report: 按阶段统计编译与执行所用的时间
+    每个阶段记录墙钟时间、CPU时间(所在线程的)、次数以及字节数 汇总到整个运行与各个定义上
+    阶段可以嵌套(比如parse中调用lex) 统计的是不含子阶段的时间
+    JIT的optimize/emit-object/link在编译线程中进行 与主线程的lookup/execute在时间上重叠
+*/
+enum class Phase {
+    Lex,        // 次数为token数 字节为读入的字符数
+    Parse,      // 次数为顶层语句数
+    CodeGen,    // 次数为生成的函数数 字节为IR指令数
+    JITAdd,     // 把module交给JIT(建立stub、记录定义)
+    Optimize,   // 次数为优化的module数 字节为优化后的IR指令数
+    EmitObject, // 次数为生成的object数 字节为object的大小
+    Link,       // 次数为链接的object数 字节为加载到内存中的代码与数据
+    Lookup,     // 顶层表达式等待JIT编译完成
+    Execute,    // 顶层表达式的执行 包含其中惰性编译所等待的时间
+    Count,
+};
+
+inline const char *PhaseName(Phase phase){
+    static const char *names[] = {"lex", "parse", "codegen", "jit-add", "optimize",
+        "emit-object", "link", "lookup", "execute"};
+    return names[static_cast<int>(phase)];
+}
+
+struct PhaseStats {
+    double wall = 0;
+    double cpu = 0;
+    uint64_t count = 0;
+    uint64_t bytes = 0;
+
+    void Add(const PhaseStats &other){
+        wall += other.wall;
+        cpu += other.cpu;
+        count += other.count;
+        bytes += other.bytes;
+    }
+};
+
+using PhaseTable = std::array<PhaseStats, static_cast<size_t>(Phase::Count)>;
+
+class TimeReport {
+public:
+    void Enable(){ enabled_ = true; }
+    bool Enabled() const { return enabled_; }
+
+    /*
+        记录一次阶段的统计 definition为空时先记在当前线程上
+        解析完一个定义(知道名字)后由Attribute归到该定义
+    */
+    void Record(Phase phase, const std::string &definition, const PhaseStats &stats){
+        std::lock_guard<std::mutex> lock{mutex_};
+        total_[static_cast<size_t>(phase)].Add(stats);
+        if(definition.empty())
+            Pending()[static_cast<size_t>(phase)].Add(stats);
+        else
+            perDefinition_[GroupName(definition)][static_cast<size_t>(phase)].Add(stats);
+    }
+
+    // 把当前线程还没有归属的统计归到definition上
+    void Attribute(const std::string &definition){
+        if(!enabled_)
+            return;
+        std::lock_guard<std::mutex> lock{mutex_};
+        auto &table = perDefinition_[GroupName(definition)];
+        auto &pending = Pending();
+        for(size_t i = 0; i < pending.size(); ++i)
+            table[i].Add(pending[i]);
+        pending = PhaseTable{};
+    }
+
+    void Print(FILE *out){
+        std::lock_guard<std::mutex> lock{mutex_};
+        fprintf(out, "===== time report =====\n");
+        fprintf(out, "%-12s %12s %12s %10s %12s\n", "phase", "wall(ms)", "cpu(ms)", "count", "bytes");
+        PhaseStats sum;
+        for(size_t i = 0; i < total_.size(); ++i){
+            auto &stats = total_[i];
+            sum.Add(stats);
+            fprintf(out, "%-12s %12.3f %12.3f %10llu %12llu\n", PhaseName(static_cast<Phase>(i)),
+                stats.wall * 1e3, stats.cpu * 1e3, (unsigned long long)stats.count, (unsigned long long)stats.bytes);
+        }
+        fprintf(out, "%-12s %12.3f %12.3f\n", "total", sum.wall * 1e3, sum.cpu * 1e3);
+        fprintf(out, "----- per definition (wall ms) -----\n");
+        for(auto &[name, table] : perDefinition_){
+            fprintf(out, "%s:", name.c_str());
+            for(size_t i = 0; i < table.size(); ++i)
+                if(table[i].count)
+                    fprintf(out, " %s=%.3f", PhaseName(static_cast<Phase>(i)), table[i].wall * 1e3);
+            fprintf(out, "\n");
+        }
+    }
+
+    void PrintJSON(FILE *out){
+        std::lock_guard<std::mutex> lock{mutex_};
+        fprintf(out, "{\"phases\": ");
+        PrintTableJSON(out, total_);
+        fprintf(out, ", \"definitions\": {");
+        bool first = true;
+        for(auto &[name, table] : perDefinition_){
+            fprintf(out, "%s\"", first ? "" : ", ");
+            for(char c : name){
+                if(c == '"' || c == '\\')
+                    fputc('\\', out);
+                fputc(c, out);
+            }
+            fprintf(out, "\": ");
+            PrintTableJSON(out, table);
+            first = false;
+        }
+        fprintf(out, "}}\n");
+    }
+
+private:
+    static PhaseTable &Pending(){
+        static thread_local PhaseTable pending;
+        return pending;
+    }
+
+    // 顶层表达式的匿名函数只执行一次 合并为一项
+    static std::string GroupName(const std::string &definition){
+        if(definition.rfind("__anon_expr", 0) == 0)
+            return "<top-level expressions>";
+        // 重新定义的函数体名为"<name>$<version>"
+        return definition.substr(0, definition.find('$'));
+    }
+
+    static void PrintTableJSON(FILE *out, const PhaseTable &table){
+        fprintf(out, "{");
+        for(size_t i = 0; i < table.size(); ++i)
+            fprintf(out, "%s\"%s\": {\"wall_ms\": %.3f, \"cpu_ms\": %.3f, \"count\": %llu, \"bytes\": %llu}",
+                i ? ", " : "", PhaseName(static_cast<Phase>(i)), table[i].wall * 1e3, table[i].cpu * 1e3,
+                (unsigned long long)table[i].count, (unsigned long long)table[i].bytes);
+        fprintf(out, "}");
+    }
+
+    bool enabled_ = false;
+    std::mutex mutex_;
+    PhaseTable total_{};
+    std::map<std::string, PhaseTable> perDefinition_;
+};
+
+inline TimeReport timeReport;
+
+// --time-report或--trace开启时才需要在各阶段计时
+inline bool PhaseTimersEnabled(){
+    return timeReport.Enabled() || traceRecorder.Enabled();
+}
+
+/*
+    统计一个阶段的作用域 未开启--time-report与--trace时构造与析构只检查标志
+    同一线程中嵌套的PhaseTimer把自己的时间从外层中扣除(trace中的事件仍是完整的区间)
+*/
+class PhaseTimer {
+public:
+    explicit PhaseTimer(Phase phase, std::string definition = "")
+        : phase_(phase), active_(PhaseTimersEnabled()) {
+        if(!active_)
+            return;
+        definition_ = std::move(definition);
+        parent_ = std::exchange(Current(), this);
+        wall_ = TraceRecorder::Now();
+        cpu_ = Now(CLOCK_THREAD_CPUTIME_ID);
+    }
+    PhaseTimer(const PhaseTimer&) = delete;
+    PhaseTimer &operator=(const PhaseTimer&) = delete;
+    ~PhaseTimer(){ Stop(); }
+
+    void AddCount(uint64_t count){ count_ += count; }
+    void AddBytes(uint64_t bytes){ bytes_ += bytes; }
+    void SetDefinition(std::string definition){ definition_ = std::move(definition); }
+
+    void Stop(){
+        if(!active_)
+            return;
+        active_ = false;
+        int64_t end = TraceRecorder::Now();
+        double wall = (end - wall_) * 1e-9;
+        double cpu = Now(CLOCK_THREAD_CPUTIME_ID) - cpu_;
+        Current() = parent_;
+        if(parent_){
+            parent_->childWall_ += wall;
+            parent_->childCpu_ += cpu;
+        }
+        if(timeReport.Enabled())
+            timeReport.Record(phase_, definition_,
+                PhaseStats{wall - childWall_, cpu - childCpu_, count_ ? count_ : 1, bytes_});
+        // 每个token一个事件太多 trace中不记录lex
+        if(traceRecorder.Enabled() && phase_ != Phase::Lex)
+            traceRecorder.Record(PhaseName(phase_), definition_, wall_, end);
+    }
+
+private:
+    static PhaseTimer *&Current(){
+        static thread_local PhaseTimer *current = nullptr;
+        return current;
+    }
+
+    static double Now(clockid_t clock){
+        timespec ts;
+        clock_gettime(clock, &ts);
+        return ts.tv_sec + ts.tv_nsec * 1e-9;
+    }
+
+    Phase phase_;
+    bool active_;
+    std::string definition_;
+    PhaseTimer *parent_ = nullptr;
+    int64_t wall_ = 0;
+    double cpu_ = 0;
+    double childWall_ = 0, childCpu_ = 0;
+    uint64_t count_ = 0, bytes_ = 0;
+};
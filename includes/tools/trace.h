@@ -0,0 +1,113 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+/*
+    --trace=FILE: 记录编译流水线各阶段的开始与结束 退出时写成Chrome Trace Event格式的JSON
+    可以在Perfetto(ui.perfetto.dev)或chrome://tracing中打开 查看各线程上的编译、链接与执行何时发生、互相等待
+    每个线程把事件追加到自己的缓冲区 缓冲区的锁只在写出时才会有竞争
+    未开启时PhaseTimer只检查一个标志 不会记录任何东西
+*/
+class TraceRecorder {
+public:
+    void Enable(){ enabled_ = true; }
+    bool Enabled() const { return enabled_; }
+
+    // 记录一段[begin, end)的事件 时间为CLOCK_MONOTONIC的纳秒数
+    void Record(const char *phase, const std::string &definition, int64_t begin, int64_t end){
+        auto &buffer = Local();
+        std::lock_guard<std::mutex> lock{buffer.mutex};
+        buffer.events.push_back({phase, definition, begin, end});
+    }
+
+    bool Write(const std::string &path){
+        FILE *out = fopen(path.c_str(), "w");
+        if(!out)
+            return false;
+        std::lock_guard<std::mutex> lock{mutex_};
+        fprintf(out, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+        bool first = true;
+        for(auto &buffer : buffers_){
+            std::lock_guard<std::mutex> bufferLock{buffer->mutex};
+            fprintf(out, "%s{\"ph\": \"M\", \"pid\": 1, \"tid\": %u, \"name\": \"thread_name\", \"args\": {\"name\": ",
+                first ? "" : ",\n", buffer->tid);
+            WriteString(out, buffer->name);
+            fprintf(out, "}}");
+            first = false;
+            for(auto &event : buffer->events){
+                fprintf(out, ",\n{\"ph\": \"X\", \"pid\": 1, \"tid\": %u, \"cat\": \"%s\", \"ts\": %.3f, \"dur\": %.3f, \"name\": ",
+                    buffer->tid, event.phase, (event.begin - origin_) / 1e3, (event.end - event.begin) / 1e3);
+                WriteString(out, event.definition.empty() ? event.phase
+                    : std::string{event.phase} + " " + event.definition);
+                fprintf(out, ", \"args\": {\"definition\": ");
+                WriteString(out, event.definition);
+                fprintf(out, "}}");
+            }
+        }
+        fprintf(out, "\n]}\n");
+        fclose(out);
+        return true;
+    }
+
+    static int64_t Now(){
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000000ll + ts.tv_nsec;
+    }
+
+private:
+    struct Event {
+        const char *phase;
+        std::string definition;
+        int64_t begin, end;
+    };
+
+    // 缓冲区由recorder持有 线程退出后它的事件仍会被写出
+    struct Buffer {
+        std::mutex mutex;
+        unsigned tid;
+        std::string name;
+        std::vector<Event> events;
+    };
+
+    Buffer &Local(){
+        static thread_local Buffer *local = nullptr;
+        if(!local){
+            auto buffer = std::make_unique<Buffer>();
+            char name[32] = "";
+            pthread_getname_np(pthread_self(), name, sizeof(name));
+            std::lock_guard<std::mutex> lock{mutex_};
+            buffer->tid = buffers_.size() + 1;
+            buffer->name = std::string{name} + " #" + std::to_string(buffer->tid);
+            local = buffer.get();
+            buffers_.push_back(std::move(buffer));
+        }
+        return *local;
+    }
+
+    static void WriteString(FILE *out, const std::string &str){
+        fputc('"', out);
+        for(unsigned char c : str){
+            if(c == '"' || c == '\\')
+                fprintf(out, "\\%c", c);
+            else if(c < 0x20)
+                fprintf(out, "\\u%04x", c);
+            else
+                fputc(c, out);
+        }
+        fputc('"', out);
+    }
+
+    bool enabled_ = false;
+    int64_t origin_ = Now();
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<Buffer>> buffers_;
+};
+
+inline TraceRecorder traceRecorder;
@@ -0,0 +1,204 @@
+#include "code_gen/aot.h"
+#include "code_gen/ir.h"
+#include "tools/options.h"
+#include "tools/remarks.h"
+#include "tools/time_report.h"
+#include <algorithm>
+#include <cstdio>
+#include <dlfcn.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/Triple.h>
+#include <llvm/IR/BasicBlock.h>
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/MC/TargetRegistry.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/Program.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Target/TargetOptions.h>
+#include <string>
+#include <vector>
+
+// 按出现顺序记录的顶层表达式匿名函数名
+static std::vector<std::string> topLevelExprs;
+// import的本地库 按出现顺序
+static std::vector<std::string> importedLibraries;
+
+bool InitAOTTarget(){
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+    llvm::InitializeNativeTargetAsmParser();
+    auto triple = llvm::sys::getDefaultTargetTriple();
+    std::string err;
+    auto target = llvm::TargetRegistry::lookupTarget(triple, err);
+    if(!target){
+        fprintf(stderr, "Error: %s\n", err.c_str());
+        return false;
+    }
+    // 生成位置无关代码 以便与默认开启PIE的系统链接器链接
+    theTargetMachine.reset(target->createTargetMachine(
+        triple, "generic", "", llvm::TargetOptions{}, llvm::Reloc::PIC_));
+    return theTargetMachine != nullptr;
+}
+
+void AddAOTTopLevelExpr(const std::string&anonFuncName){
+    topLevelExprs.push_back(anonFuncName);
+}
+
+/*
+    与JIT模式一样在import时检查库: 带目录的路径检查文件是否存在
+    只有文件名的库试着dlopen 确认能在系统的库目录中找到
+*/
+bool AddAOTLibrary(const std::string&path, std::string&error){
+    if(path.find('/') != std::string::npos){
+        if(!llvm::sys::fs::exists(path)){
+            error = path + ": no such file";
+            return false;
+        }
+    }else if(void *handle = dlopen(path.c_str(), RTLD_LAZY | RTLD_LOCAL)){
+        dlclose(handle);
+    }else{
+        error = dlerror();
+        return false;
+    }
+    if(std::find(importedLibraries.begin(), importedLibraries.end(), path) == importedLibraries.end())
+        importedLibraries.push_back(path);
+    return true;
+}
+
+/*
+    生成:
+    define i32 @main() {
+        call double @__anon_expr_0()
+        ...
+        call void @hoshino_output_flush()
+        ret i32 0
+    }
+*/
+static bool GenerateMain(){
+    if(theModule->getFunction("main")){
+        fprintf(stderr, "Error: 'main' is reserved in --emit-obj/--emit-exe mode\n");
+        return false;
+    }
+    auto ft = llvm::FunctionType::get(llvm::Type::getInt32Ty(*theContext), false);
+    auto mainFunc = llvm::Function::Create(ft, llvm::Function::ExternalLinkage,
+        "main", theModule.get());
+    builder->SetInsertPoint(llvm::BasicBlock::Create(*theContext, "entry", mainFunc));
+    for(auto&name : topLevelExprs){
+        if(auto func = theModule->getFunction(name))
+            builder->CreateCall(func, {});
+    }
+    // 写出内置函数缓冲的输出 之后才打印--profile的统计
+    auto flushFn = theModule->getOrInsertFunction("hoshino_output_flush", builder->getVoidTy());
+    builder->CreateCall(flushFn, {});
+    // --profile: 可执行文件退出前打印统计
+    if(hoshinoOptions.profile){
+        auto reportFn = theModule->getOrInsertFunction("hoshino_profile_report",
+            builder->getVoidTy(), builder->getInt8PtrTy());
+        builder->CreateCall(reportFn, llvm::ConstantPointerNull::get(builder->getInt8PtrTy()));
+    }
+    builder->CreateRet(llvm::ConstantInt::get(llvm::Type::getInt32Ty(*theContext), 0));
+    return !llvm::verifyFunction(*mainFunc, &llvm::errs());
+}
+
+static bool WriteObject(const std::string&path){
+    theModule->setTargetTriple(theTargetMachine->getTargetTriple().str());
+    std::error_code ec;
+    llvm::raw_fd_ostream dest(path, ec, llvm::sys::fs::OF_None);
+    if(ec){
+        fprintf(stderr, "Error: could not open %s: %s\n", path.c_str(), ec.message().c_str());
+        return false;
+    }
+    PhaseTimer timer{Phase::EmitObject, "<aot module>"};
+    llvm::legacy::PassManager pass;
+    if(theTargetMachine->addPassesToEmitFile(pass, dest, nullptr, llvm::CGFT_ObjectFile)){
+        fprintf(stderr, "Error: target can't emit an object file\n");
+        return false;
+    }
+    pass.run(*theModule);
+    dest.flush();
+    timer.AddBytes(dest.tell());
+    return true;
+}
+
+// builtin_lib是动态链接进hoshino的 通过dladdr找到当前进程加载的libbuiltin_lib所在目录
+static std::string BuiltinLibDir(){
+    Dl_info info;
+    void *sym = dlsym(RTLD_DEFAULT, "printNum");
+    if(sym && dladdr(sym, &info) && info.dli_fname){
+        llvm::SmallString<128> path{info.dli_fname};
+        llvm::sys::fs::make_absolute(path);
+        return std::string{llvm::sys::path::parent_path(path)};
+    }
+    return {};
+}
+
+static bool LinkExecutable(const std::string&objPath, const std::string&exePath){
+    llvm::ErrorOr<std::string> driver = std::make_error_code(std::errc::no_such_file_or_directory);
+    for(auto name : {"cc", "clang", "gcc", "c++"}){
+        if((driver = llvm::sys::findProgramByName(name)))
+            break;
+    }
+    if(!driver){
+        fprintf(stderr, "Error: no C compiler driver found to link %s\n", exePath.c_str());
+        return false;
+    }
+    std::string libDir = BuiltinLibDir();
+    std::vector<std::string> args{*driver, objPath, "-o", exePath};
+    if(!libDir.empty()){
+        args.push_back("-L" + libDir);
+        args.push_back("-Wl,-rpath," + libDir);
+    }
+    args.push_back("-lbuiltin_lib");
+    /*
+        带目录的路径直接链接 并把库所在目录加入rpath
+        只有文件名的(比如libm.so.6)与dlopen一样在系统的库目录中查找
+    */
+    for(auto&lib : importedLibraries){
+        if(lib.find('/') == std::string::npos){
+            args.push_back("-l:" + lib);
+            continue;
+        }
+        llvm::SmallString<128> path{lib};
+        llvm::sys::fs::make_absolute(path);
+        args.push_back(std::string{path});
+        args.push_back("-Wl,-rpath," + std::string{llvm::sys::path::parent_path(path)});
+    }
+    std::vector<llvm::StringRef> argRefs{args.begin(), args.end()};
+    std::string errMsg;
+    int rc = llvm::sys::ExecuteAndWait(*driver, argRefs, llvm::None, {}, 0, 0, &errMsg);
+    if(rc != 0){
+        fprintf(stderr, "Error: linking %s failed %s\n", exePath.c_str(), errMsg.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool EmitAOTOutput(){
+    if(!GenerateMain())
+        return false;
+    {
+        PhaseTimer timer{Phase::Optimize, "<aot module>"};
+        RemarkScope remarks{*theContext};
+        llvm::orc::HoshinoJIT::runFunctionPasses(*theModule);
+        timer.AddBytes(theModule->getInstructionCount());
+    }
+    if(llvm::verifyModule(*theModule, &llvm::errs()))
+        return false;
+    const auto&opts = hoshinoOptions;
+    if(opts.emitMode == EmitMode::Object)
+        return WriteObject(opts.outputFile);
+    // exe模式先写到临时object 链接完成后删除
+    llvm::SmallString<128> objPath;
+    if(llvm::sys::fs::createTemporaryFile("hoshino", "o", objPath)){
+        fprintf(stderr, "Error: could not create a temporary object file\n");
+        return false;
+    }
+    bool ok = WriteObject(std::string{objPath}) && 
+              LinkExecutable(std::string{objPath}, opts.outputFile);
+    llvm::sys::fs::remove(objPath);
+    return ok;
+}
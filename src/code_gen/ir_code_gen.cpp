@@ -1,6 +1,7 @@
 #include "ast/basic_ast.h"
 #include "code_gen/ir.h"
 #include "lexer/token.h"
+#include "lib.h"
 #include "tools/basic_tool.h"
 #include "tools/ir_tool.h"
 #include <algorithm>
@@ -19,6 +20,7 @@
 #include <llvm/IR/Value.h>
 #include <llvm/IR/Verifier.h>
 #include <memory>
+#include <optional>
 #include <utility>
 #include <vector>
 using namespace hoshino;
@@ -44,7 +46,7 @@ auto CodeGenVisitor::CodeGen(StrExprAST *ast) -> llvm::Value* {
 auto CodeGenVisitor::CodeGen(VariableExprAST *ast) -> llvm::Value * {
     llvm::AllocaInst* val = namedValues[ast->name_];
     if(!val)
-        LOG_ERROR_V("unknow variable name");
+        return LOG_ERROR_V("unknow variable name");
     return builder->CreateLoad(val->getAllocatedType()
         , val, ast->name_);
 }
@@ -52,7 +54,8 @@ auto CodeGenVisitor::CodeGen(VariableExprAST *ast) -> llvm::Value * {
 // llvm生成的指令的两个操作数必须类型相同 返回的结果也与操作数类型相同
 // (hoshino所有操作数都是double 所以不必在意这个问题)
 auto CodeGenVisitor::CodeGen(BinaryExprAST *ast) -> llvm::Value* {
-    // 
+    // 操作数不在尾位置 只有运算符函数本身的调用可能是尾调用
+    bool isTail = std::exchange(tailPosition_, false);
     if(ast->op_ == "="){
         auto lhsExpr = dynamic_cast<VariableExprAST*>(ast->lhs_.get());
         // 若=运算左边不是一个变量 则返回错误
@@ -65,6 +68,8 @@ auto CodeGenVisitor::CodeGen(BinaryExprAST *ast) -> llvm::Value* {
         llvm::AllocaInst *variable = namedValues[lhsExpr->name_];
         if(!variable)
             return LOG_ERROR_V("unknow variable name");
+        if(parforReadOnly_.count(variable))
+            return LOG_ERROR_V("parfor body can only assign its own variables and reduction variables");
         builder->CreateStore(rVal, variable);
         return rVal;
     }
@@ -114,23 +119,31 @@ auto CodeGenVisitor::CodeGen(BinaryExprAST *ast) -> llvm::Value* {
     //     break;
     // }
     // 如果二元运算符不是内建运算符 则查找用户定义运算符
-    llvm::Function *func = getFunction(std::string{"binary@"} + ast->op_);
+    llvm::Function *func = getOperatorFunction(std::string{"binary@"} + ast->op_);
     assert(func && "binary operator function not found");
-    return builder->CreateCall(func, {l, r}, "binop");
+    calleeNames.insert(func->getName().str());
+    auto *call = builder->CreateCall(func, {l, r}, "binop");
+    call->setTailCall(isTail);
+    return call;
 }
 
 auto CodeGenVisitor::CodeGen(UnaryExprAST *ast) -> llvm::Value* {
+    bool isTail = std::exchange(tailPosition_, false);
     // 操作数
     llvm::Value *operandVal = ast->operand_->ToLLvmValue(this);
     if(!operandVal)
         return nullptr;
-    auto func = getFunction(std::string{"unary@"} + ast->op_);
+    auto func = getOperatorFunction(std::string{"unary@"} + ast->op_);
     if(!func)
         return LOG_ERROR_V("unknow unary operator");
-    return builder->CreateCall(func, operandVal, "unop");
+    calleeNames.insert(func->getName().str());
+    auto *call = builder->CreateCall(func, operandVal, "unop");
+    call->setTailCall(isTail);
+    return call;
 }
 
 auto CodeGenVisitor::CodeGen(VarExprAST *ast) -> llvm::Value* {
+    tailPosition_ = false;
 
     auto theFunc = builder->GetInsertBlock()->getParent();
     const std::string&varName = ast->varNames_.first;
@@ -229,6 +242,8 @@ ifcont-out:                                       ; preds = %else-in, %ifcont-in
 auto CodeGenVisitor::CodeGen(IfExprAST *ast) -> llvm::Value* {
     auto ifRet = CreateEntryBlockAlloca(builder->GetInsertBlock()->getParent(), 
                 "ifRet", llvm::Type::getDoubleTy(*theContext));
+    // 条件不在尾位置 then/else分支继承if所在的位置
+    bool isTail = std::exchange(tailPosition_, false);
     llvm::Value *condition_val = ast->condition_->ToLLvmValue(this);
     if(!condition_val)
         return nullptr;
@@ -252,6 +267,7 @@ auto CodeGenVisitor::CodeGen(IfExprAST *ast) -> llvm::Value* {
     builder->CreateCondBr(condition_val, thenBB, elseBB);
     // 往then分支插入指令
     builder->SetInsertPoint(thenBB);
+    tailPosition_ = isTail;
     llvm::Value *then_val = ast->then_->ToLLvmValue(this);
     if(!then_val)
         return nullptr;
@@ -276,6 +292,7 @@ auto CodeGenVisitor::CodeGen(IfExprAST *ast) -> llvm::Value* {
     // else可能没有
     if(ast->else_){
         // TODO: BlockExpr始终返回0
+        tailPosition_ = isTail;
         else_val = ast->else_->ToLLvmValue(this);
         if(!else_val)
             return nullptr;
@@ -304,6 +321,7 @@ auto CodeGenVisitor::CodeGen(IfExprAST *ast) -> llvm::Value* {
 }
 
 auto CodeGenVisitor::CodeGen(ForExprAST *ast) -> llvm::Value* {
+    tailPosition_ = false;
     llvm::Function*theFunction = builder->GetInsertBlock()->getParent();
     llvm::Value*startVal = ast->start_->ToLLvmValue(this);
     // 创建alloca局部变量
@@ -358,6 +376,11 @@ auto CodeGenVisitor::CodeGen(ForExprAST *ast) -> llvm::Value* {
     // 计算新值并存回去
     // auto curVal = builder->CreateLoad(alloca->getAllocatedType(), alloca, ast->varName_.c_str());
     builder->CreateStore(stepVal, alloca);
+    if(profileTrips_){
+        auto *i64Ty = builder->getInt64Ty();
+        builder->CreateStore(builder->CreateAdd(builder->CreateLoad(i64Ty, profileTrips_), 
+            llvm::ConstantInt::get(i64Ty, 1)), profileTrips_);
+    }
     // auto nextVal = builder->CreateFAdd(curVal, stepVal, "nextVar");
     // builder->CreateStore(nextVal, alloca);
     
@@ -378,10 +401,364 @@ auto CodeGenVisitor::CodeGen(ForExprAST *ast) -> llvm::Value* {
     return llvm::Constant::getNullValue(llvm::Type::getDoubleTy(*theContext));
 }
 
+namespace {
+auto ReduceOpOf(const std::string &op) -> HoshinoReduceOp {
+    if(op == "*")
+        return HOSHINO_REDUCE_MUL;
+    if(op == "min")
+        return HOSHINO_REDUCE_MIN;
+    if(op == "max")
+        return HOSHINO_REDUCE_MAX;
+    return HOSHINO_REDUCE_ADD;
+}
+}
+
+/*
+    parfor的循环体被提取为internal函数 void body(double *env, i64 begin, i64 end, double *partials)
+    env = [start, step, 捕获的变量...] 外层的变量按值捕获 循环体中只读
+    归约变量在每个分块中从单位元开始 分块结束时写回partials 由运行时合并后写回外层变量
+    运行时hoshino_parfor按grain分块 由builtin_lib的work-stealing线程池执行
+*/
+auto CodeGenVisitor::CodeGen(ParforExprAST *ast) -> llvm::Value* {
+    tailPosition_ = false;
+    auto *doubleTy = builder->getDoubleTy();
+    auto *doublePtrTy = doubleTy->getPointerTo();
+    auto *i64Ty = builder->getInt64Ty();
+    llvm::Function *parent = builder->GetInsertBlock()->getParent();
+    llvm::Value *startVal = ast->start_->ToLLvmValue(this);
+    if(!startVal)
+        return nullptr;
+    llvm::Value *boundVal = ast->bound_->ToLLvmValue(this);
+    if(!boundVal)
+        return nullptr;
+    llvm::Value *stepVal = ast->step_ ? ast->step_->ToLLvmValue(this) 
+        : llvm::ConstantFP::get(doubleTy, 1.0);
+    if(!stepVal)
+        return nullptr;
+    llvm::Value *grainVal = ast->grain_ ? ast->grain_->ToLLvmValue(this) 
+        : llvm::ConstantFP::get(doubleTy, 0.0);
+    if(!grainVal)
+        return nullptr;
+    std::vector<llvm::AllocaInst*> reduceVars;
+    for(auto &[op, name] : ast->reductions_){
+        auto it = namedValues.find(name);
+        if(it == namedValues.end() || !it->second)
+            return LOG_ERROR_V(("unknow reduction variable '" + name + "'").c_str());
+        if(parforReadOnly_.count(it->second))
+            return LOG_ERROR_V("cannot reduce into a captured variable in parfor");
+        reduceVars.push_back(it->second);
+    }
+    // 捕获外层的变量 $开头的是编译器使用的变量(比如$ret)
+    std::vector<std::pair<std::string, llvm::AllocaInst*>> captures;
+    for(auto &[name, alloca] : namedValues)
+        if(alloca && name != ast->varName_ && name[0] != '$' 
+            && std::find(reduceVars.begin(), reduceVars.end(), alloca) == reduceVars.end())
+            captures.emplace_back(name, alloca);
+    auto *envTy = llvm::ArrayType::get(doubleTy, 2 + captures.size());
+    auto *env = CreateEntryBlockAlloca(parent, "parfor.env", envTy);
+    builder->CreateStore(startVal, builder->CreateConstInBoundsGEP2_32(envTy, env, 0, 0));
+    builder->CreateStore(stepVal, builder->CreateConstInBoundsGEP2_32(envTy, env, 0, 1));
+    for(size_t k = 0; k < captures.size(); ++k){
+        auto *alloca = captures[k].second;
+        builder->CreateStore(builder->CreateLoad(alloca->getAllocatedType(), alloca, captures[k].first), 
+            builder->CreateConstInBoundsGEP2_32(envTy, env, 0, 2 + k));
+    }
+
+    // 生成循环体函数 期间保存外层函数的插入点与变量表
+    auto *bodyTy = llvm::FunctionType::get(builder->getVoidTy(), 
+        {doublePtrTy, i64Ty, i64Ty, doublePtrTy}, false);
+    auto *bodyFunc = llvm::Function::Create(bodyTy, llvm::Function::InternalLinkage,
+        parent->getName() + ".parfor." + std::to_string(parforCount_++), theModule.get());
+    auto *savedBB = builder->GetInsertBlock();
+    auto savedIP = builder->GetInsertPoint();
+    auto savedValues = namedValues;
+    auto savedReadOnly = parforReadOnly_;
+    auto *savedFrame = std::exchange(spawnFrame_, nullptr);
+    auto *savedTrips = std::exchange(profileTrips_, nullptr);
+    auto restore = [&]{
+        builder->SetInsertPoint(savedBB, savedIP);
+        namedValues = std::move(savedValues);
+        parforReadOnly_ = std::move(savedReadOnly);
+        spawnFrame_ = savedFrame;
+        profileTrips_ = savedTrips;
+    };
+    auto *envArg = bodyFunc->getArg(0);
+    auto *beginArg = bodyFunc->getArg(1);
+    auto *endArg = bodyFunc->getArg(2);
+    auto *partialsArg = bodyFunc->getArg(3);
+    envArg->setName("env");
+    beginArg->setName("begin");
+    endArg->setName("end");
+    partialsArg->setName("partials");
+    builder->SetInsertPoint(llvm::BasicBlock::Create(*theContext, "entry", bodyFunc));
+    namedValues.clear();
+    for(size_t k = 0; k < captures.size(); ++k){
+        auto *alloca = CreateEntryBlockAlloca(bodyFunc, captures[k].first, doubleTy);
+        builder->CreateStore(builder->CreateLoad(doubleTy, 
+            builder->CreateConstInBoundsGEP1_32(doubleTy, envArg, 2 + k)), alloca);
+        namedValues[captures[k].first] = alloca;
+        parforReadOnly_.insert(alloca);
+    }
+    std::vector<llvm::AllocaInst*> localReduce;
+    for(size_t j = 0; j < ast->reductions_.size(); ++j){
+        auto &name = ast->reductions_[j].second;
+        auto *alloca = CreateEntryBlockAlloca(bodyFunc, name, doubleTy);
+        builder->CreateStore(builder->CreateLoad(doubleTy, 
+            builder->CreateConstInBoundsGEP1_32(doubleTy, partialsArg, j)), alloca);
+        namedValues[name] = alloca;
+        localReduce.push_back(alloca);
+    }
+    auto *bodyStart = builder->CreateLoad(doubleTy, builder->CreateConstInBoundsGEP1_32(doubleTy, envArg, 0), "start");
+    auto *bodyStep = builder->CreateLoad(doubleTy, builder->CreateConstInBoundsGEP1_32(doubleTy, envArg, 1), "step");
+    auto *loopVar = CreateEntryBlockAlloca(bodyFunc, ast->varName_, doubleTy);
+    namedValues[ast->varName_] = loopVar;
+    parforReadOnly_.insert(loopVar);
+    auto *counter = CreateEntryBlockAlloca(bodyFunc, "parfor.k", i64Ty);
+    builder->CreateStore(beginArg, counter);
+    auto *condBB = llvm::BasicBlock::Create(*theContext, "parfor_cond", bodyFunc);
+    auto *loopBB = llvm::BasicBlock::Create(*theContext, "parfor_body", bodyFunc);
+    auto *exitBB = llvm::BasicBlock::Create(*theContext, "parfor_exit", bodyFunc);
+    builder->CreateBr(condBB);
+    builder->SetInsertPoint(condBB);
+    auto *k = builder->CreateLoad(i64Ty, counter, "k");
+    builder->CreateCondBr(builder->CreateICmpSLT(k, endArg), loopBB, exitBB);
+    builder->SetInsertPoint(loopBB);
+    // 第k次迭代的循环变量为start + k*step 与顺序执行的for每次加step一致
+    builder->CreateStore(builder->CreateFAdd(bodyStart, 
+        builder->CreateFMul(builder->CreateSIToFP(k, doubleTy), bodyStep)), loopVar);
+    if(!ast->body_->ToLLvmValue(this)){
+        restore();
+        bodyFunc->eraseFromParent();
+        return nullptr;
+    }
+    builder->CreateStore(builder->CreateAdd(k, llvm::ConstantInt::get(i64Ty, 1)), counter);
+    builder->CreateBr(condBB);
+    builder->SetInsertPoint(exitBB);
+    for(size_t j = 0; j < localReduce.size(); ++j)
+        builder->CreateStore(builder->CreateLoad(doubleTy, localReduce[j]), 
+            builder->CreateConstInBoundsGEP1_32(doubleTy, partialsArg, j));
+    EmitImplicitSync();
+    builder->CreateRetVoid();
+    llvm::verifyFunction(*bodyFunc);
+    restore();
+
+    // 外层函数: 传入归约变量的当前值 运行时合并各分块的结果后写回
+    size_t reductions = ast->reductions_.size();
+    auto *resultsTy = llvm::ArrayType::get(doubleTy, std::max<size_t>(reductions, 1));
+    auto *results = CreateEntryBlockAlloca(parent, "parfor.results", resultsTy);
+    auto *opsTy = llvm::ArrayType::get(builder->getInt32Ty(), std::max<size_t>(reductions, 1));
+    auto *ops = CreateEntryBlockAlloca(parent, "parfor.ops", opsTy);
+    for(size_t j = 0; j < reductions; ++j){
+        builder->CreateStore(builder->CreateLoad(doubleTy, reduceVars[j]), 
+            builder->CreateConstInBoundsGEP2_32(resultsTy, results, 0, j));
+        builder->CreateStore(builder->getInt32(ReduceOpOf(ast->reductions_[j].first)), 
+            builder->CreateConstInBoundsGEP2_32(opsTy, ops, 0, j));
+    }
+    auto parforFn = theModule->getOrInsertFunction("hoshino_parfor", builder->getVoidTy(),
+        bodyTy->getPointerTo(), doublePtrTy, doubleTy, doubleTy, doubleTy, doubleTy, 
+        builder->getInt32Ty(), builder->getInt32Ty()->getPointerTo(), doublePtrTy);
+    builder->CreateCall(parforFn, {bodyFunc, 
+        builder->CreateConstInBoundsGEP2_32(envTy, env, 0, 0), 
+        startVal, boundVal, stepVal, grainVal, builder->getInt32(reductions), 
+        builder->CreateConstInBoundsGEP2_32(opsTy, ops, 0, 0), 
+        builder->CreateConstInBoundsGEP2_32(resultsTy, results, 0, 0)});
+    for(size_t j = 0; j < reductions; ++j)
+        builder->CreateStore(builder->CreateLoad(doubleTy, 
+            builder->CreateConstInBoundsGEP2_32(resultsTy, results, 0, j)), reduceVars[j]);
+    return llvm::Constant::getNullValue(doubleTy);
+}
+
+/*
+    函数中第一次使用spawn/await/sync时 在入口块分配frame并初始化
+    frame记录该函数spawn出的任务 函数返回前由EmitImplicitSync等待它们完成
+*/
+auto CodeGenVisitor::GetSpawnFrame() -> llvm::Value* {
+    if(spawnFrame_)
+        return spawnFrame_;
+    llvm::Function *theFunc = builder->GetInsertBlock()->getParent();
+    auto *frameTy = llvm::ArrayType::get(builder->getInt64Ty(), HOSHINO_SPAWN_FRAME_SIZE / 8);
+    auto *frame = CreateEntryBlockAlloca(theFunc, "spawn.frame", frameTy);
+    llvm::IRBuilder<>entryBuilder{frame->getParent(), std::next(frame->getIterator())};
+    spawnFrame_ = entryBuilder.CreateBitCast(frame, builder->getInt8PtrTy(), "spawn.frame.ptr");
+    auto initFn = theModule->getOrInsertFunction("hoshino_frame_init", 
+        builder->getVoidTy(), builder->getInt8PtrTy());
+    entryBuilder.CreateCall(initFn, spawnFrame_);
+    return spawnFrame_;
+}
+
+void CodeGenVisitor::EmitImplicitSync(){
+    if(!spawnFrame_)
+        return;
+    auto releaseFn = theModule->getOrInsertFunction("hoshino_frame_release", 
+        builder->getVoidTy(), builder->getInt8PtrTy());
+    builder->CreateCall(releaseFn, spawnFrame_);
+}
+
+/*
+    --profile: 函数的编号在第一次调用时按名字取得 缓存在internal的全局变量中(与memo表相同)
+    for循环的次数累加在入口处的局部变量中 mem2reg之后是寄存器 返回时连同编号一起报告
+*/
+void CodeGenVisitor::EmitProfileEnter(llvm::Function *theFunc, const std::string &name){
+    auto *i32Ty = builder->getInt32Ty();
+    auto *i64Ty = builder->getInt64Ty();
+    auto idFn = theModule->getOrInsertFunction("hoshino_profile_id", i32Ty, builder->getInt8PtrTy());
+    auto enterFn = theModule->getOrInsertFunction("hoshino_profile_enter", builder->getVoidTy(), i32Ty);
+    auto *slot = new llvm::GlobalVariable(*theModule, i32Ty, false, llvm::GlobalValue::InternalLinkage,
+        llvm::ConstantInt::getSigned(i32Ty, -1), "profile." + theFunc->getName());
+    profileTrips_ = CreateEntryBlockAlloca(theFunc, "profile.trips", i64Ty);
+    builder->CreateStore(llvm::ConstantInt::get(i64Ty, 0), profileTrips_);
+    auto *cached = builder->CreateLoad(i32Ty, slot, "profile.cached");
+    auto *entryBB = builder->GetInsertBlock();
+    auto *initBB = llvm::BasicBlock::Create(*theContext, "profile.init", theFunc);
+    auto *enterBB = llvm::BasicBlock::Create(*theContext, "profile.enter", theFunc);
+    builder->CreateCondBr(builder->CreateICmpSLT(cached, builder->getInt32(0)), initBB, enterBB);
+    builder->SetInsertPoint(initBB);
+    auto *created = builder->CreateCall(idFn, builder->CreateGlobalStringPtr(name, "profile.name"));
+    builder->CreateStore(created, slot);
+    builder->CreateBr(enterBB);
+    builder->SetInsertPoint(enterBB);
+    auto *id = builder->CreatePHI(i32Ty, 2, "profile.id");
+    id->addIncoming(cached, entryBB);
+    id->addIncoming(created, initBB);
+    builder->CreateCall(enterFn, id);
+    profileId_ = id;
+}
+
+void CodeGenVisitor::EmitProfileExits(llvm::Function *theFunc){
+    auto *i64Ty = builder->getInt64Ty();
+    auto exitFn = theModule->getOrInsertFunction("hoshino_profile_exit", builder->getVoidTy(),
+        builder->getInt32Ty(), i64Ty);
+    std::vector<llvm::ReturnInst*> rets;
+    for(auto &bb : *theFunc)
+        if(auto *ret = llvm::dyn_cast<llvm::ReturnInst>(bb.getTerminator()))
+            rets.push_back(ret);
+    for(auto *ret : rets){
+        llvm::IRBuilder<>exitBuilder{ret};
+        exitBuilder.CreateCall(exitFn, {profileId_, exitBuilder.CreateLoad(i64Ty, profileTrips_, "profile.trips")});
+    }
+}
+
+/*
+    带类型标注的extern: double与C类型之间的转换
+    整数向零取整 ptr为地址的数值 void返回值作为0
+*/
+static auto ToNativeValue(llvm::IRBuilder<> &b, llvm::Value *value, llvm::Type *type) -> llvm::Value* {
+    if(type->isDoubleTy())
+        return value;
+    if(type->isFloatTy())
+        return b.CreateFPTrunc(value, type, "native.arg");
+    if(type->isPointerTy())
+        return b.CreateIntToPtr(b.CreateFPToUI(value, b.getInt64Ty()), type, "native.arg");
+    return b.CreateFPToSI(value, type, "native.arg");
+}
+
+static auto FromNativeValue(llvm::IRBuilder<> &b, llvm::Value *value) -> llvm::Value* {
+    auto *type = value->getType();
+    auto *doubleTy = b.getDoubleTy();
+    if(type->isDoubleTy())
+        return value;
+    if(type->isVoidTy())
+        return llvm::ConstantFP::get(doubleTy, 0.0);
+    if(type->isFloatTy())
+        return b.CreateFPExt(value, doubleTy, "native.ret");
+    if(type->isPointerTy())
+        return b.CreateUIToFP(b.CreatePtrToInt(value, b.getInt64Ty()), doubleTy, "native.ret");
+    return b.CreateSIToFP(value, doubleTy, "native.ret");
+}
+
+static auto GetNativeLLVMType(NativeType type) -> llvm::Type* {
+    switch(type){
+    case NativeType::F32:
+        return llvm::Type::getFloatTy(*theContext);
+    case NativeType::I32:
+        return llvm::Type::getInt32Ty(*theContext);
+    case NativeType::I64:
+        return llvm::Type::getInt64Ty(*theContext);
+    case NativeType::Ptr:
+        return llvm::Type::getInt8PtrTy(*theContext);
+    case NativeType::Void:
+        return llvm::Type::getVoidTy(*theContext);
+    default:
+        return llvm::Type::getDoubleTy(*theContext);
+    }
+}
+
+/*
+    spawn f(args): 参数在当前函数中求值后写入数组 由运行时复制到future中
+    每个spawn处生成一个internal的thunk: double thunk(double *args) 取出参数调用f
+    句柄是future的地址 按位存放在double中
+*/
+auto CodeGenVisitor::CodeGen(SpawnExprAST *ast) -> llvm::Value* {
+    tailPosition_ = false;
+    auto *call = ast->call_.get();
+    llvm::Function *calleeFunc = getFunction(call->callee_);
+    if(!calleeFunc)
+        return LOG_ERROR_V("Unknow function reference");
+    if(calleeFunc->arg_size() != call->args_.size())
+        return LOG_ERROR_V("Incorrect # arguments passed");
+    calleeNames.insert(call->callee_);
+    auto *doubleTy = builder->getDoubleTy();
+    llvm::Function *theFunc = builder->GetInsertBlock()->getParent();
+    size_t nargs = call->args_.size();
+    auto *argsTy = llvm::ArrayType::get(doubleTy, std::max<size_t>(nargs, 1));
+    auto *args = CreateEntryBlockAlloca(theFunc, "spawn.args", argsTy);
+    // 调用带类型标注的extern时参数先按类型转换 (字符串字面量取得地址) 在thunk中再转换一次
+    auto *calleeTy = calleeFunc->getFunctionType();
+    for(size_t i = 0; i < nargs; ++i){
+        llvm::Value *arg = EmitNativeArgument(call->args_[i].get(), calleeTy->getParamType(i));
+        if(!arg)
+            return nullptr;
+        arg = FromNativeValue(*builder, arg);
+        builder->CreateStore(arg, builder->CreateConstInBoundsGEP2_32(argsTy, args, 0, i));
+    }
+
+    auto *thunkTy = llvm::FunctionType::get(doubleTy, {doubleTy->getPointerTo()}, false);
+    auto *thunk = llvm::Function::Create(thunkTy, llvm::Function::InternalLinkage,
+        theFunc->getName() + ".spawn." + std::to_string(spawnCount_++), theModule.get());
+    llvm::IRBuilder<>thunkBuilder{llvm::BasicBlock::Create(*theContext, "entry", thunk)};
+    std::vector<llvm::Value*>thunkArgs;
+    for(size_t i = 0; i < nargs; ++i)
+        thunkArgs.push_back(ToNativeValue(thunkBuilder, thunkBuilder.CreateLoad(doubleTy, 
+            thunkBuilder.CreateConstInBoundsGEP1_32(doubleTy, thunk->getArg(0), i)), calleeTy->getParamType(i)));
+    thunkBuilder.CreateRet(FromNativeValue(thunkBuilder, thunkBuilder.CreateCall(calleeFunc, thunkArgs)));
+    llvm::verifyFunction(*thunk);
+
+    auto *ptrTy = builder->getInt8PtrTy();
+    auto spawnFn = theModule->getOrInsertFunction("hoshino_spawn", ptrTy, ptrTy, 
+        thunkTy->getPointerTo(), doubleTy->getPointerTo(), builder->getInt32Ty());
+    auto *future = builder->CreateCall(spawnFn, {GetSpawnFrame(), thunk, 
+        builder->CreateConstInBoundsGEP2_32(argsTy, args, 0, 0), builder->getInt32(nargs)}, "future");
+    return builder->CreateBitCast(builder->CreatePtrToInt(future, builder->getInt64Ty()), doubleTy, "handle");
+}
+
+auto CodeGenVisitor::CodeGen(AwaitExprAST *ast) -> llvm::Value* {
+    tailPosition_ = false;
+    llvm::Value *handle = ast->handle_->ToLLvmValue(this);
+    if(!handle)
+        return nullptr;
+    auto *ptrTy = builder->getInt8PtrTy();
+    auto *future = builder->CreateIntToPtr(
+        builder->CreateBitCast(handle, builder->getInt64Ty()), ptrTy, "future");
+    auto awaitFn = theModule->getOrInsertFunction("hoshino_await", 
+        builder->getDoubleTy(), ptrTy, ptrTy);
+    return builder->CreateCall(awaitFn, {GetSpawnFrame(), future}, "awaittmp");
+}
+
+auto CodeGenVisitor::CodeGen(SyncExprAST *ast) -> llvm::Value* {
+    tailPosition_ = false;
+    // 只等待 future留在frame中 之后的await仍能取得结果
+    auto syncFn = theModule->getOrInsertFunction("hoshino_sync", 
+        builder->getVoidTy(), builder->getInt8PtrTy());
+    builder->CreateCall(syncFn, GetSpawnFrame());
+    return llvm::Constant::getNullValue(builder->getDoubleTy());
+}
+
 auto CodeGenVisitor::CodeGen(BlockExprAST *ast) -> llvm::Value* {
-    // BlockExpr以最后一句表达式作为返回
+    // BlockExpr以最后一句表达式作为返回 只有最后一句继承block所在的尾位置
+    bool isTail = std::exchange(tailPosition_, false);
     llvm::Value *ret = nullptr;
     for(auto&expr : ast->body_) {
+        tailPosition_ = isTail && &expr == &ast->body_.back();
         if(ret = expr->ToLLvmValue(this); !ret){
             return nullptr;
         }
@@ -391,30 +768,53 @@ auto CodeGenVisitor::CodeGen(BlockExprAST *ast) -> llvm::Value* {
 }
 
 
+// 字符串字面量传给ptr参数时传入以'\0'结尾的常量字符串的地址
+auto CodeGenVisitor::EmitNativeArgument(ExprAST *arg, llvm::Type *type) -> llvm::Value* {
+    if(auto *str = dynamic_cast<StrExprAST*>(arg); str && type->isPointerTy())
+        return builder->CreateGlobalStringPtr(str->val_, "str");
+    llvm::Value *value = arg->ToLLvmValue(this);
+    if(!value)
+        return nullptr;
+    return ToNativeValue(*builder, value, type);
+}
+
 auto CodeGenVisitor::CodeGen(CallExprAST *ast) -> llvm::Value* {
+    // 参数不在尾位置
+    bool isTail = std::exchange(tailPosition_, false);
     llvm::Function *calleeFunc = getFunction(ast->callee_);
     if(!calleeFunc)
         return LOG_ERROR_V("Unknow function reference");
     if(calleeFunc->arg_size() != ast->args_.size())
         return LOG_ERROR_V("Incorrect # arguments passed");
+    calleeNames.insert(ast->callee_);
+    auto *calleeTy = calleeFunc->getFunctionType();
     std::vector<llvm::Value*> args_val;
     for(size_t i{0}; i!=ast->args_.size(); ++i){
-        args_val.push_back(ast->args_[i]->ToLLvmValue(this));
+        args_val.push_back(EmitNativeArgument(ast->args_[i].get(), calleeTy->getParamType(i)));
         // 确保新加进args_val的llvm value*不为nullptr
         if(!args_val.back())
             return nullptr;
     }
-    return builder->CreateCall(calleeFunc, args_val, "calltmp");
+    /*
+        hoshino的值都是double 不会把调用者栈上的变量地址传给被调用者 所以尾位置上的调用都可以标记为tail
+        优化时TailCallElim会把自身的尾递归改写为循环 其他的尾调用由后端尽量生成跳转(sibling call)
+    */
+    auto *call = builder->CreateCall(calleeFunc, args_val, 
+        calleeTy->getReturnType()->isVoidTy() ? "" : "calltmp");
+    call->setTailCall(isTail);
+    return FromNativeValue(*builder, call);
 }
 
 auto CodeGenVisitor::CodeGen(PrototypeAST *ast) -> llvm::Function* {
-    std::vector<llvm::Type*>doubles {ast->args_name_.size(), 
+    // 没有类型标注的参数与返回值都是double
+    std::vector<llvm::Type*>argsType {ast->args_name_.size(), 
         llvm::Type::getDoubleTy(*theContext)};
+    for(size_t i = 0; i < ast->args_type_.size(); ++i)
+        argsType[i] = GetNativeLLVMType(ast->args_type_[i]);
     // function类型 包括返回值、所有参数的类型(数组)、参数是否可变
     llvm::FunctionType *ft = llvm::FunctionType::get(
-        // TODO: funtion参数类型暂时定为double，后续将支持多类型
-        llvm::Type::getDoubleTy(*theContext),
-        doubles,
+        GetNativeLLVMType(ast->return_type_),
+        argsType,
         false
     );
     // 创建extern函数声明到module中 名称为ast->name_
@@ -432,15 +832,142 @@ auto CodeGenVisitor::CodeGen(PrototypeAST *ast) -> llvm::Function* {
     return func;
 }
 
+namespace {
+// pure函数的memo表与保存本次调用参数的数组 函数返回前把结果插入表中
+struct MemoState {
+    llvm::Value *table = nullptr;
+    llvm::Value *args = nullptr;
+};
+}
+
+/*
+    pure函数的入口: 取得memo表(第一次调用时按名字创建) 把参数写入数组后查表
+    命中时直接返回缓存的结果 未命中时builder停在函数体开始的位置
+*/
+static auto EmitMemoLookup(llvm::Function *theFunc) -> MemoState {
+    auto *doubleTy = builder->getDoubleTy();
+    auto *ptrTy = builder->getInt8PtrTy();
+    auto tableFn = theModule->getOrInsertFunction("hoshino_memo_table",
+        ptrTy, ptrTy, builder->getInt32Ty());
+    auto lookupFn = theModule->getOrInsertFunction("hoshino_memo_lookup",
+        builder->getInt32Ty(), ptrTy, doubleTy->getPointerTo(), doubleTy->getPointerTo());
+    // 表的指针缓存在internal的全局变量中 重新定义的函数体各有一份 按名字取得的是同一张表
+    auto *slot = new llvm::GlobalVariable(*theModule, ptrTy, false, llvm::GlobalValue::InternalLinkage,
+        llvm::ConstantPointerNull::get(ptrTy), "memo." + theFunc->getName());
+    auto *cached = builder->CreateLoad(ptrTy, slot, "memo.cached");
+    auto *entryBB = builder->GetInsertBlock();
+    auto *initBB = llvm::BasicBlock::Create(*theContext, "memo.init", theFunc);
+    auto *lookupBB = llvm::BasicBlock::Create(*theContext, "memo.lookup", theFunc);
+    builder->CreateCondBr(builder->CreateIsNull(cached), initBB, lookupBB);
+    builder->SetInsertPoint(initBB);
+    auto *created = builder->CreateCall(tableFn, {
+        builder->CreateGlobalStringPtr(MemoTableName(theFunc->getName().str()), "memo.name"),
+        builder->getInt32(theFunc->arg_size())});
+    builder->CreateStore(created, slot);
+    builder->CreateBr(lookupBB);
+
+    builder->SetInsertPoint(lookupBB);
+    auto *table = builder->CreatePHI(ptrTy, 2, "memo.table");
+    table->addIncoming(cached, entryBB);
+    table->addIncoming(created, initBB);
+    auto *arrayTy = llvm::ArrayType::get(doubleTy, std::max<size_t>(theFunc->arg_size(), 1));
+    auto *args = CreateEntryBlockAlloca(theFunc, "memo.args", arrayTy);
+    for(auto &arg : theFunc->args())
+        builder->CreateStore(&arg, builder->CreateConstInBoundsGEP2_32(arrayTy, args, 0, arg.getArgNo()));
+    auto *argsPtr = builder->CreateConstInBoundsGEP2_32(arrayTy, args, 0, 0);
+    auto *result = CreateEntryBlockAlloca(theFunc, "memo.result", doubleTy);
+    auto *hit = builder->CreateCall(lookupFn, {table, argsPtr, result}, "memo.hit");
+    auto *hitBB = llvm::BasicBlock::Create(*theContext, "memo.hit", theFunc);
+    auto *missBB = llvm::BasicBlock::Create(*theContext, "memo.miss", theFunc);
+    builder->CreateCondBr(builder->CreateICmpNE(hit, builder->getInt32(0)), hitBB, missBB);
+    builder->SetInsertPoint(hitBB);
+    builder->CreateRet(builder->CreateLoad(doubleTy, result, "memo.value"));
+    builder->SetInsertPoint(missBB);
+    return {table, argsPtr};
+}
+
+static void EmitMemoInsert(const MemoState &memo, llvm::Value *result){
+    auto insertFn = theModule->getOrInsertFunction("hoshino_memo_insert", builder->getVoidTy(),
+        builder->getInt8PtrTy(), builder->getDoubleTy()->getPointerTo(), builder->getDoubleTy());
+    builder->CreateCall(insertFn, {memo.table, memo.args, result});
+}
+
+/*
+    函数体生成完成后(calleeNames已经收集好)检查副作用 并更新sideEffectFree与memoFunctions
+    pure函数只能调用没有副作用的函数 已经被pure函数依赖的函数重新定义时不能引入副作用
+    拒绝时不修改任何表 原型与运算符优先级由CodeGen(FunctionAST*)换回原来的定义
+*/
+static bool CheckPurity(const PrototypeAST &proto){
+    std::string name{proto.GetFuncName()};
+    // 顶层表达式的匿名函数执行一次后就被丢弃 不需要记录
+    if(name.rfind(anonymous_expr_name, 0) == 0)
+        return true;
+    auto impure = std::find_if(calleeNames.begin(), calleeNames.end(), [&](const std::string &callee){
+        return callee != name && !sideEffectFree.count(callee);
+    });
+    if(impure != calleeNames.end()){
+        if(proto.isPure()){
+            LOG_ERROR(("pure function calls '" + *impure + "' which may have side effects").c_str());
+            return false;
+        }
+        if(sideEffectFree.count(name)){
+            if(auto dependents = MemoFunctionsDependingOn(name); !dependents.empty()){
+                LOG_ERROR(("redefinition calls '" + *impure + "' and would give side effects to pure function '"
+                    + dependents.front() + "'").c_str());
+                return false;
+            }
+        }
+        sideEffectFree.erase(name);
+    }else{
+        sideEffectFree[name] = calleeNames;
+    }
+    if(proto.isPure())
+        memoFunctions.insert(name);
+    else
+        memoFunctions.erase(name);
+    return true;
+}
+
 auto CodeGenVisitor::CodeGen(FunctionAST *ast) -> llvm::Function* {
     auto &proto = *ast->proto_;
+    std::string name{proto.GetFuncName()};
+    auto it = functionProtos.find(name);
+    // 重新定义时参数个数必须不变 已经编译好的调用者仍按原来的参数个数经过stub调用
+    if(it != functionProtos.end() && it->second->args_name_.size() != proto.args_name_.size())
+        return (llvm::Function*)LOG_ERROR_V("redefinition must keep the number of arguments");
+    /*
+        失败的定义不能影响已有的定义: 先保存原来的原型(之前的定义或extern声明)与运算符优先级
+        出错时换回去 第一次定义出错时才把它们删除
+    */
+    std::unique_ptr<PrototypeAST> oldProto;
+    if(it != functionProtos.end())
+        oldProto = std::move(it->second);
+    std::optional<int> oldPrecedence;
+    if(proto.isBinaryOp())
+        if(auto prec = binOpPrecedence.find(proto.GetOperator()); prec != binOpPrecedence.end())
+            oldPrecedence = prec->second;
+    auto rollback = [&]{
+        ast->proto_ = std::move(functionProtos[name]);
+        if(oldProto)
+            functionProtos[name] = std::move(oldProto);
+        else
+            functionProtos.erase(name);
+        if(proto.isBinaryOp()){
+            if(oldPrecedence)
+                binOpPrecedence[proto.GetOperator()] = *oldPrecedence;
+            else
+                binOpPrecedence.erase(proto.GetOperator());
+        }
+    };
     // 注册到全局函数表
-    functionProtos[std::string{proto.GetFuncName()}] = std::move(ast->proto_);
+    functionProtos[name] = std::move(ast->proto_);
     // 从找到extern声明 
     auto theFunc = getFunction(proto.GetFuncName());
     // 创建失败则返回nullptr
-    if(!theFunc)
+    if(!theFunc){
+        rollback();
         return nullptr;
+    }
     if(proto.isBinaryOp())
         binOpPrecedence[proto.GetOperator()] = proto.GetBinaryPrecedence();
     /* 
@@ -459,8 +986,10 @@ auto CodeGenVisitor::CodeGen(FunctionAST *ast) -> llvm::Function* {
         }
     }
     // 在此 我们断言该func还没有实现(函数体为空)
-    if(!theFunc->empty())
+    if(!theFunc->empty()){
+        rollback();
         return (llvm::Function*)LOG_ERROR_V("function cannot be redefined");
+    }
     // BasicBlock是一个重要的概念 这里创建了一个block名为entry 将其插入到theFunc中
     auto *bb = llvm::BasicBlock::Create(*theContext, 
         "entry", theFunc);
@@ -468,6 +997,8 @@ auto CodeGenVisitor::CodeGen(FunctionAST *ast) -> llvm::Function* {
     builder->SetInsertPoint(bb);
     // 将函数参数记录在表中
     namedValues.clear();
+    calleeNames.clear();
+    spawnFrame_ = nullptr;
     // 为函数参数创建alloca局部变量到栈上
     for(auto&arg : theFunc->args()) {
         auto alloca = CreateEntryBlockAlloca(theFunc, arg.getName().str(), arg.getType());
@@ -478,13 +1009,35 @@ auto CodeGenVisitor::CodeGen(FunctionAST *ast) -> llvm::Function* {
     auto res = CreateEntryBlockAlloca(theFunc,
              "$ret", llvm::Type::getDoubleTy(*theContext));
     namedValues[res->getName().str()] = res;
+    // 顶层表达式的匿名函数合并为一项
+    profileId_ = nullptr;
+    profileTrips_ = nullptr;
+    bool isTopLevel = proto.GetFuncName().rfind(anonymous_expr_name, 0) == 0;
+    if(hoshinoOptions.profile)
+        EmitProfileEnter(theFunc, isTopLevel ? "<top-level>" : std::string{proto.GetFuncName()});
+    // pure函数先查memo表 结果在返回前插入表中 因此函数体中没有尾调用
+    MemoState memo;
+    if(proto.isPure())
+        memo = EmitMemoLookup(theFunc);
     // 给函数体创建指令 并获得返回的Value 如果不出错 则会在entry block中创建指令
-    if(llvm::Value *retVal = ast->body_->ToLLvmValue(this)){
+    // 统计调用时间需要在返回前调用hoshino_profile_exit 同样没有尾调用
+    tailPosition_ = !proto.isPure() && !profileId_;
+    llvm::Value *retVal = ast->body_->ToLLvmValue(this);
+    tailPosition_ = false;
+    // 副作用检查失败与函数体出错相同 走下面的rollback
+    if(retVal && !CheckPurity(proto))
+        retVal = nullptr;
+    if(retVal){
         // retVal为函数体中的顶层表达式的ast的llvm Value
         // 创建llvm ret指令 表示函数的完成
         builder->CreateStore(retVal, res);
+        EmitImplicitSync();
         auto ret_val = builder->CreateLoad(res->getAllocatedType(), res, "$ret");
+        if(proto.isPure())
+            EmitMemoInsert(memo, ret_val);
         builder->CreateRet(ret_val);
+        if(profileId_)
+            EmitProfileExits(theFunc);
         // 利用verifyFunction对生成的代码进行各种一致性检查 它可以捕获许多错误
         llvm::verifyFunction(*theFunc);
         // 使用function pass manager内的pass优化函数体
@@ -497,8 +1050,7 @@ auto CodeGenVisitor::CodeGen(FunctionAST *ast) -> llvm::Function* {
     // 如果不从符号表中抹除 llvm不会允许将来再次出现相同的函数
     // 即 如果你第一次函数写错了 没有抹除它 则第二次再写一遍相同的函数是不被允许的
     theFunc->eraseFromParent();
-    if(proto.isBinaryOp())
-        binOpPrecedence.erase(proto.GetOperator());
+    rollback();
     return nullptr;
     
 }
\ No newline at end of file
@@ -1,23 +1,131 @@
+#include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <cstdio>
 #include <llvm/ExecutionEngine/JITSymbol.h>
 #include <llvm/Support/Error.h>
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
+#include <map>
 #include <memory>
+#include <set>
+#include <string>
+#include <unordered_map>
 #include <utility>
+#include <vector>
 #include "jit/HoshinoJIT.h"
+#include "code_gen/aot.h"
+#include "tools/options.h"
 #include "lexer/token.h"
 #include "code_gen/ir.h"
 #include "tools/ir_tool.h"
+#include "tools/basic_tool.h"
+#include "tools/mem_report.h"
+#include "tools/remarks.h"
+#include "tools/source_locations.h"
+#include "tools/time_report.h"
 #include "context.h"
+#include "lib.h"
+
+/*
+    JIT出错时的处理：普通模式下直接退出(exitOnErr)
+    守护进程模式下不能因为一个脚本的错误退出整个进程 只打印错误并跳过当前的定义/表达式
+*/
+static bool CheckJITError(llvm::Error err){
+    if(!err)
+        return true;
+    if(!hoshinoOptions.daemon)
+        exitOnErr(std::move(err));
+    ++errorCount;
+    llvm::logAllUnhandledErrors(std::move(err), diags(), "Error: ");
+    return false;
+}
+
+/*
+    报告当前程序在执行时发生的JIT错误(惰性编译失败的函数返回了NaN)
+    与CheckJITError相同 普通模式下退出 守护进程模式下计入程序的错误
+*/
+static void ReportSessionErrors(){
+    auto errors = theJIT->takeSessionErrors(theJIT->getCurrentJITDylib());
+    if(errors.empty())
+        return;
+    for(auto&message : errors)
+        fprintf(diagOutput, "Error: %s\n", message.c_str());
+    if(!hoshinoOptions.daemon)
+        exit(1);
+    errorCount += errors.size();
+}
+
+/*
+    回收当前dylib中不可达的函数定义(被undef且没有可达的调用者)
+    该函数可以在嵌入hoshino时直接调用 也由undef语句与--reclaim=auto策略使用
+*/
+void ReclaimUnreachableCode(){
+    if(!theJIT)
+        return;
+    auto result = theJIT->reclaimUnreachable();
+    if(!CheckJITError(result.takeError()) || result->Definitions == 0)
+        return;
+    fprintf(diagOutput, "Reclaimed %zu definition(s), %zu bytes\n",
+        result->Definitions, result->Bytes);
+}
+
+static void HandleUndef(){
+    auto fnName = ParseUndef();
+    if(fnName.empty())
+        return;
+    auto it = functionProtos.find(fnName);
+    if(it == functionProtos.end()){
+        LOG_ERROR("Unknow function in undef");
+        return;
+    }
+    // 之后的代码不能再调用该函数 由用户定义的双目运算符也不再被识别
+    if(it->second->isBinaryOp())
+        binOpPrecedence.erase(it->second->GetOperator());
+    functionProtos.erase(it);
+    operatorBodies.erase(fnName);
+    operatorInliners.erase(fnName);
+    inlinerBodies.erase(fnName);
+    // sideEffectFree中的记录保留: 仍可能被pure函数经过stub调用 重新定义时同样不能引入副作用
+    memoFunctions.erase(fnName);
+    if(!theJIT)
+        return;
+    theJIT->unrootDefinition(fnName);
+    ReclaimUnreachableCode();
+}
+
+/*
+    import "libfoo.so": 之后extern声明的函数也在库中查找
+    AOT模式下记录库的路径 链接可执行文件时一起链接
+*/
+static void HandleImport(){
+    auto path = ParseImport();
+    if(path.empty())
+        return;
+    if(!theJIT){
+        if(std::string error; !AddAOTLibrary(path, error))
+            LOG_ERROR(("could not import library: " + error).c_str());
+        return;
+    }
+    if(auto err = theJIT->importLibrary(path))
+        LOG_ERROR(("could not import library: " + llvm::toString(std::move(err))).c_str());
+}
 
 static void HandleExtern(){
-    if(auto protoAST = ParseExtern()){
+    std::unique_ptr<hoshino::PrototypeAST> protoAST;
+    {
+        PhaseTimer timer{Phase::Parse};
+        protoAST = ParseExtern();
+        if(protoAST)
+            timer.SetDefinition(std::string{protoAST->GetFuncName()});
+    }
+    if(protoAST){
+        std::string name{protoAST->GetFuncName()};
+        timeReport.Attribute(name);
         if(auto *fnIR = protoAST->ToLLvmValue(codeGenerator.get())){
-            fprintf(stderr, "Read extern:\n");
-            fnIR->print(llvm::errs());
-            fprintf(stderr, "\n");
+            fprintf(diagOutput, "Read extern:\n");
+            fnIR->print(diags());
+            fprintf(diagOutput, "\n");
             // 函数声明注册到全局函数表中
             functionProtos[std::string{protoAST->GetFuncName()}] = std::move(protoAST);
         }
@@ -26,15 +134,106 @@ static void HandleExtern(){
     }
 }
 
+/*
+    记录定义在源码中的位置 供--perf与--remarks使用
+    守护进程中提交的脚本没有文件名 用程序的dylib名代替
+*/
+static void RecordSourceLocation(const std::string &name, unsigned line){
+    if(!sourceLocations.Enabled())
+        return;
+    std::string file = hoshinoOptions.daemon
+        ? theJIT->getCurrentJITDylib().getName() : hoshinoOptions.sourceFile;
+    sourceLocations.Set(name, {std::move(file), line});
+}
+
+/*
+    运算符op重新定义后 之前复制了它的函数体并内联的定义仍在使用旧的函数体
+    从保存的bitcode重新生成这些定义: 丢弃其中复制的运算符函数体 换成当前的定义后重新复制
+    再按热重定义加入JIT(stub指向新的函数体) 经过stub调用它们的函数不需要重新编译
+*/
+static void RecompileOperatorInliners(const std::string &op){
+    auto it = operatorInliners.find(op);
+    if(it == operatorInliners.end())
+        return;
+    auto inliners = std::move(it->second);
+    operatorInliners.erase(it);
+    for(auto &name : inliners){
+        auto body = inlinerBodies.find(name);
+        if(body == inlinerBodies.end())
+            continue;
+        auto buffer = llvm::MemoryBuffer::getMemBuffer(body->second, name, false);
+        auto mod = llvm::parseBitcodeFile(buffer->getMemBufferRef(), *theContext);
+        if(!CheckJITError(mod.takeError()))
+            continue;
+        std::vector<std::string> copies;
+        for(auto &F : **mod)
+            if(F.hasAvailableExternallyLinkage()){
+                copies.push_back(F.getName().str());
+                F.deleteBody();
+            }
+        if(llvm::Linker::linkModules(*theModule, std::move(*mod))){
+            LOG_ERROR(("could not recompile '" + name + "' after redefining '" + op + "'").c_str());
+            InitModuleAndManager();
+            continue;
+        }
+        for(auto &copy : copies)
+            ImportOperatorBody(copy);
+        SaveInlinerBody(name);
+        memoryAccounting.RecordModule(*theModule);
+        PhaseTimer addTimer{Phase::JITAdd, name};
+        CheckJITError(theJIT->addModule(
+            llvm::orc::ThreadSafeModule(std::move(theModule), std::move(theContext))));
+        addTimer.Stop();
+        InitModuleAndManager();
+    }
+}
+
 static void HandleDefinition(){
-    if(auto fnAST = ParseDefinition()){
-        if(auto *fnIR = codeGenerator->CodeGen(fnAST.get())){
+    unsigned line = GetTokenLine();
+    std::unique_ptr<hoshino::FunctionAST> fnAST;
+    {
+        PhaseTimer timer{Phase::Parse};
+        fnAST = ParseDefinition();
+        if(fnAST)
+            timer.SetDefinition(std::string{fnAST->GetFuncName()});
+    }
+    if(fnAST){
+        PhaseTimer codegenTimer{Phase::CodeGen, std::string{fnAST->GetFuncName()}};
+        auto *fnIR = codeGenerator->CodeGen(fnAST.get());
+        if(fnIR)
+            codegenTimer.AddBytes(fnIR->getInstructionCount());
+        codegenTimer.Stop();
+        if(fnIR){
+            auto funcName = fnIR->getName().str();
+            timeReport.Attribute(funcName);
+            RecordSourceLocation(funcName, line);
+            // AOT模式与整体编译模式下所有函数都留在同一个module中
+            if(!theJIT || hoshinoOptions.wholeProgram)
+                return;
+            // 运算符的函数体保存一份 之后的module中调用该运算符时复制进去内联
+            if(auto it = functionProtos.find(funcName);
+                it != functionProtos.end() && (it->second->isBinaryOp() || it->second->isUnaryOp()))
+                SaveOperatorBody(funcName);
+            SaveInlinerBody(funcName);
             // 一个函数定义放在一个module里
-            exitOnErr(theJIT->addModule(
+            memoryAccounting.RecordModule(*theModule);
+            PhaseTimer addTimer{Phase::JITAdd, funcName};
+            bool added = CheckJITError(theJIT->addModule(
                 llvm::orc::ThreadSafeModule(std::move(theModule), std::move(theContext))
             ));
-            
+            addTimer.Stop();
+            // 记录该函数的callee 该函数第一次编译时会推测编译这些callee
+            if(added)
+                theJIT->getSpeculator().registerCallees(
+                    theJIT->getCurrentJITDylib().getName(), funcName, std::move(calleeNames));
             InitModuleAndManager();
+            if(added){
+                // 内联了该运算符旧的函数体的定义按新的函数体重新编译
+                RecompileOperatorInliners(funcName);
+                // 重新定义后 依赖该函数的pure函数缓存的结果不再可信
+                for(auto &memo : MemoFunctionsDependingOn(funcName))
+                    hoshino_memo_clear(MemoTableName(memo).c_str());
+            }
         }
         
     } else{
@@ -42,32 +241,84 @@ static void HandleDefinition(){
     }
 }
 
+// 整体编译模式下按出现顺序保存的顶层表达式匿名函数名 解析完成后依次执行
+static std::vector<std::string> wholeProgramExprs;
+
 static void HandleTopLevelExpr(){
+    unsigned line = GetTokenLine();
     std::string anonFuncName;
-    if(auto fnAST = ParseTopLevelExpr(anonFuncName)){
-        if(auto fnIR = codeGenerator->CodeGen(fnAST.get())){
+    std::unique_ptr<hoshino::FunctionAST> fnAST;
+    {
+        PhaseTimer timer{Phase::Parse};
+        fnAST = ParseTopLevelExpr(anonFuncName);
+        timer.SetDefinition(anonFuncName);
+    }
+    if(fnAST){
+        PhaseTimer codegenTimer{Phase::CodeGen, anonFuncName};
+        auto *fnIR = codeGenerator->CodeGen(fnAST.get());
+        if(fnIR)
+            codegenTimer.AddBytes(fnIR->getInstructionCount());
+        codegenTimer.Stop();
+        timeReport.Attribute(anonFuncName);
+        if(fnIR){
+            RecordSourceLocation(anonFuncName, line);
 #ifdef DEBUG
-            fprintf(stderr, "Read Function not optimized:\n");
-            fnIR->print(llvm::errs());
-            fprintf(stderr, "\n");
+            fprintf(diagOutput, "Read Function not optimized:\n");
+            fnIR->print(diags());
+            fprintf(diagOutput, "\n");
 #endif
-            auto res_tracker = theJIT->getMainJITDylib().createResourceTracker();
+            if(!theJIT){
+                AddAOTTopLevelExpr(anonFuncName);
+                return;
+            }
+            if(hoshinoOptions.wholeProgram){
+                wholeProgramExprs.push_back(anonFuncName);
+                return;
+            }
+            auto res_tracker = theJIT->getCurrentJITDylib().createResourceTracker();
+            memoryAccounting.RecordModule(*theModule);
             // 将当前的module给顶级表达式的匿名函数使用
             auto thread_safe_mod = 
                 llvm::orc::ThreadSafeModule(std::move(theModule), std::move(theContext));
-            exitOnErr(theJIT->addModule(
-                std::move(thread_safe_mod), res_tracker));
+            PhaseTimer addTimer{Phase::JITAdd, anonFuncName};
+            if(!CheckJITError(theJIT->addEagerModule(
+                std::move(thread_safe_mod), res_tracker))){
+                InitModuleAndManager();
+                return;
+            }
+            addTimer.Stop();
+            theJIT->getSpeculator().registerCallees(
+                theJIT->getCurrentJITDylib().getName(), anonFuncName, std::move(calleeNames));
             // 前面将module给了匿名函数用 外层新建另外的module
             InitModuleAndManager();
             // jit中找匿名函数
-            auto exprSymbol = exitOnErr(theJIT->lookup(anonFuncName));
-            assert(exprSymbol && "function not found");
+            PhaseTimer lookupTimer{Phase::Lookup, anonFuncName};
+            auto exprSymbol = theJIT->lookup(anonFuncName);
+            lookupTimer.Stop();
+            if(!CheckJITError(exprSymbol.takeError())){
+                CheckJITError(res_tracker->remove());
+                theJIT->getSpeculator().unregister(
+                    theJIT->getCurrentJITDylib().getName(), anonFuncName);
+                functionProtos.erase(anonFuncName);
+                return;
+            }
+            assert(*exprSymbol && "function not found");
             
-            auto funcAddr = exprSymbol.getAddress();
+            auto funcAddr = exprSymbol->getAddress();
             auto fn = llvm::jitTargetAddressToPointer<double(*)()>(funcAddr);
-            fprintf(stderr, "Evaluated to %f\n", fn());
+            PhaseTimer executeTimer{Phase::Execute, anonFuncName};
+            double result = fn();
+            executeTimer.Stop();
+            // 内置函数的输出先于结果出现
+            hoshino_output_flush();
+            fprintf(diagOutput, "Evaluated to %f\n", result);
+            ReportSessionErrors();
             // 从JIT中删除匿名函数的module 所有之前添加到该module的函数定义都会消失
-            exitOnErr(res_tracker->remove());
+            CheckJITError(res_tracker->remove());
+            theJIT->getSpeculator().unregister(
+                theJIT->getCurrentJITDylib().getName(), anonFuncName);
+            // 匿名函数不会再被调用 从全局函数注册表中移除 否则注册表会无限增长
+            functionProtos.erase(anonFuncName);
             // // 从符号表中移出匿名函数名字 即__anon_expr
             // fnIR->eraseFromParent();
         }
@@ -76,9 +327,37 @@ static void HandleTopLevelExpr(){
     }
 }
 
+// --mem-limit计入的内存: JIT的代码与数据以及AST节点
+static size_t AccountedBytes(){
+    size_t bytes = memoryAccounting.GetASTStats().bytes;
+    if(theJIT)
+        bytes += theJIT->getCodeStats().getLiveBytes();
+    return bytes;
+}
+
+/*
+    --mem-limit: 超出软上限时(evict先回收不可达的函数与被取代的函数体)警告
+    回到上限以下之前不再重复警告
+*/
+static void CheckMemoryLimit(){
+    static std::atomic<bool> overLimit{false};
+    size_t limit = hoshinoOptions.memLimitMB << 20;
+    if(hoshinoOptions.memLimitEvict && AccountedBytes() > limit)
+        ReclaimUnreachableCode();
+    size_t bytes = AccountedBytes();
+    if(bytes <= limit){
+        overLimit = false;
+        return;
+    }
+    if(overLimit.exchange(true))
+        return;
+    fprintf(diagOutput, "Warning: accounted memory (%zu bytes) exceeds --mem-limit=%zuMB\n",
+        bytes, hoshinoOptions.memLimitMB);
+}
+
 void MainLoop(){
     while (true) {
-        // fprintf(stderr, ">>> ");
+        // fprintf(diagOutput, ">>> ");
         switch (curTok) {
         case TOK_EOF:
             return;
@@ -91,25 +370,247 @@ void MainLoop(){
         case TOK_EXTERN:
             HandleExtern();
             break;
+        case TOK_UNDEF:
+            HandleUndef();
+            break;
+        case TOK_IMPORT:
+            HandleImport();
+            break;
         default:
             HandleTopLevelExpr();
             break;
         }
+        if(hoshinoOptions.reclaimPolicy == ReclaimPolicy::Auto && theJIT
+            && theJIT->getReclaimer().getPendingUnrooted() > 0)
+            ReclaimUnreachableCode();
+        if(hoshinoOptions.memLimitMB)
+            CheckMemoryLimit();
     }
 }
 
 
-void SettingContext(std::string sourceFile){
-    sourceInput = std::make_unique<std::ifstream>(sourceFile);
+void InitContext(){
+    if(hoshinoOptions.timeReport)
+        timeReport.Enable();
+    if(!hoshinoOptions.traceFile.empty())
+        traceRecorder.Enable();
+    if(hoshinoOptions.remarkKinds
+        && !remarkCollector.Enable(hoshinoOptions.remarkKinds, hoshinoOptions.remarksFilter))
+        exit(1);
+    if(hoshinoOptions.perf != PerfSupport::None || remarkCollector.Enabled())
+        sourceLocations.Enable();
+    if(hoshinoOptions.memReport || hoshinoOptions.memLimitMB)
+        memoryAccounting.Enable();
+    hoshino_memo_set_capacity(hoshinoOptions.memoSize);
+    if(!hoshinoOptions.outputTarget.empty() && !hoshino_output_open(hoshinoOptions.outputTarget.c_str())){
+        fprintf(stderr, "Error: could not open %s\n", hoshinoOptions.outputTarget.c_str());
+        exit(1);
+    }
     InitBinOpPrecedence();
     InitValidBinOpSet();
-    InitJIT();
+    if(hoshinoOptions.emitMode == EmitMode::JIT)
+        InitJIT();
+    else if(!InitAOTTarget())
+        exit(1);
     InitModuleAndManager();
     InitCodeVisitor();
-    fprintf(stderr, ">>> ");
+}
+
+void SettingContext(std::string sourceFile){
+    sourceInput = std::make_unique<std::ifstream>(sourceFile);
+    InitContext();
+    fprintf(diagOutput, ">>> ");
     GetNextToken();
 }
 
-void ContextClose(){
-    theModule->print(llvm::errs(), nullptr);
-}
\ No newline at end of file
+// prelude加载完成时的函数注册表与运算符优先级
+static std::map<std::string, hoshino::PrototypeAST> preludeProtos;
+static std::unordered_map<std::string, int> preludePrecedence;
+static std::map<std::string, std::string> preludeOperatorBodies;
+static std::map<std::string, std::set<std::string>> preludeSideEffectFree;
+static std::set<std::string> preludeMemoFunctions;
+
+void SavePreludeState(){
+    preludeProtos.clear();
+    for(auto&[name, proto] : functionProtos)
+        preludeProtos.emplace(name, *proto);
+    preludePrecedence = binOpPrecedence;
+    preludeOperatorBodies = operatorBodies;
+    preludeSideEffectFree = sideEffectFree;
+    preludeMemoFunctions = memoFunctions;
+}
+
+void ResetFrontendState(){
+    // 守护进程中程序在新的线程里编译 该线程的前端状态还未初始化
+    if(validBinOp.empty())
+        InitValidBinOpSet();
+    if(!codeGenerator)
+        InitCodeVisitor();
+    functionProtos.clear();
+    for(auto&[name, proto] : preludeProtos)
+        functionProtos[name] = std::make_unique<hoshino::PrototypeAST>(proto);
+    binOpPrecedence = preludePrecedence;
+    operatorBodies = preludeOperatorBodies;
+    sideEffectFree = preludeSideEffectFree;
+    memoFunctions = preludeMemoFunctions;
+    // prelude中的定义不随程序重新编译 只记录程序自己的定义
+    operatorInliners.clear();
+    inlinerBodies.clear();
+    namedValues.clear();
+    calleeNames.clear();
+    errorCount = 0;
+    ResetLexer();
+    InitModuleAndManager();
+}
+
+/*
+    整体编译模式: 对包含整个源文件的module做过程间优化 交给JIT编译一次 再按顺序执行顶层表达式
+*/
+static void RunWholeProgram(){
+    PhaseTimer optimizeTimer{Phase::Optimize, "<whole program>"};
+    {
+        RemarkScope remarks{*theContext};
+        llvm::orc::HoshinoJIT::runWholeProgramPasses(*theModule, wholeProgramExprs);
+    }
+    optimizeTimer.AddBytes(theModule->getInstructionCount());
+    optimizeTimer.Stop();
+#ifdef DEBUG
+    fprintf(diagOutput, "Whole program optimized:\n");
+    theModule->print(diags(), nullptr);
+#endif
+    auto res_tracker = theJIT->getCurrentJITDylib().createResourceTracker();
+    memoryAccounting.RecordModule(*theModule);
+    bool added = CheckJITError(theJIT->addOptimizedModule(
+        llvm::orc::ThreadSafeModule(std::move(theModule), std::move(theContext)), res_tracker));
+    InitModuleAndManager();
+    if(!added)
+        return;
+    for(auto&anonFuncName : wholeProgramExprs){
+        auto exprSymbol = theJIT->lookup(anonFuncName);
+        if(!CheckJITError(exprSymbol.takeError()))
+            break;
+        auto fn = llvm::jitTargetAddressToPointer<double(*)()>(exprSymbol->getAddress());
+        PhaseTimer executeTimer{Phase::Execute, anonFuncName};
+        double result = fn();
+        executeTimer.Stop();
+        hoshino_output_flush();
+        fprintf(diagOutput, "Evaluated to %f\n", result);
+        ReportSessionErrors();
+    }
+    wholeProgramExprs.clear();
+    CheckJITError(res_tracker->remove());
+}
+
+/*
+    --mem-report: 当前线程的前端状态以及JIT中的代码与数据
+    每个定义的字节数为其函数体ResourceTracker中的代码与数据 其余的(prelude、顶层表达式等)计入other
+*/
+static void PrintMemoryReport(FILE *out){
+    auto ast = memoryAccounting.GetASTStats();
+    auto contexts = memoryAccounting.GetContextStats();
+    size_t bitcodeBytes = 0;
+    for(auto &[name, bitcode] : operatorBodies)
+        bitcodeBytes += bitcode.size();
+    fprintf(out, "===== memory report =====\n");
+    fprintf(out, "resident set size:      %zu KB\n", MemoryAccounting::ResidentBytes() >> 10);
+    fprintf(out, "AST nodes:              live %zu (%zu bytes), peak %zu bytes, %zu allocated\n",
+        ast.nodes, ast.bytes, ast.peakBytes, ast.allocated);
+    fprintf(out, "function prototypes:    %zu\n", functionProtos.size());
+    fprintf(out, "operator bodies:        %zu (%zu bytes of bitcode)\n", operatorBodies.size(), bitcodeBytes);
+    size_t inlinerBytes = 0;
+    for(auto &[name, bitcode] : inlinerBodies)
+        inlinerBytes += bitcode.size();
+    fprintf(out, "operator inliners:      %zu (%zu bytes of bitcode)\n", inlinerBodies.size(), inlinerBytes);
+    fprintf(out, "LLVM contexts/modules:  live %zu (%zu IR instructions), peak %zu, %zu created\n",
+        contexts.live, contexts.instructions, contexts.peakLive, contexts.created);
+    if(!theJIT)
+        return;
+    auto &codeStats = theJIT->getCodeStats();
+    fprintf(out, "JIT code and data:      live %zu bytes, reclaimed %zu bytes\n",
+        codeStats.getLiveBytes(), codeStats.getReclaimedBytes());
+    if(!theJIT->isUsingJITLink()){
+        static const char *kinds[] = {"code", "rodata", "rwdata"};
+        for(int kind = 0; kind < llvm::orc::SlabMemoryPool::NumKinds; ++kind){
+            auto stats = theJIT->getMemoryPool().getStats(static_cast<llvm::orc::SlabMemoryPool::Kind>(kind));
+            fprintf(out, "  %-6s slabs:          mapped %zu bytes, in use %zu bytes, peak %zu bytes\n",
+                kinds[kind], stats.MappedBytes, stats.InUseBytes, stats.PeakInUseBytes);
+        }
+    }
+    auto definitions = theJIT->getDefinitionMemory();
+    size_t attributed = 0;
+    fprintf(out, "%-32s %12s %12s\n", "definition", "bytes", "superseded");
+    for(auto &def : definitions){
+        std::string name = def.Dylib == theJIT->getMainJITDylib().getName()
+            ? def.Name : def.Dylib + " " + def.Name;
+        fprintf(out, "%-32s %12zu %12zu\n", name.c_str(), def.Bytes, def.SupersededBytes);
+        attributed += def.Bytes + def.SupersededBytes;
+    }
+    size_t live = codeStats.getLiveBytes();
+    fprintf(out, "%-32s %12zu\n", "<other>", live - std::min(attributed, live));
+}
+
+/*
+    --mem-report: 写到diagOutput
+    --remarks: 写到--remarks-file指定的文件 或diagOutput
+    --trace: 写出Chrome trace
+    --time-report: 写到--time-report-file指定的文件 或diagOutput
+*/
+static void WriteReports(){
+    if(hoshinoOptions.memReport)
+        PrintMemoryReport(diagOutput);
+    if(remarkCollector.Enabled()){
+        FILE *out = hoshinoOptions.remarksFile.empty()
+            ? diagOutput : fopen(hoshinoOptions.remarksFile.c_str(), "w");
+        if(!out)
+            fprintf(diagOutput, "Error: could not open %s\n", hoshinoOptions.remarksFile.c_str());
+        else if(hoshinoOptions.remarksYAML)
+            remarkCollector.PrintYAML(out);
+        else
+            remarkCollector.Print(out);
+        if(out && out != diagOutput)
+            fclose(out);
+    }
+    if(traceRecorder.Enabled() && !traceRecorder.Write(hoshinoOptions.traceFile))
+        fprintf(diagOutput, "Error: could not write trace to %s\n", hoshinoOptions.traceFile.c_str());
+    if(!timeReport.Enabled())
+        return;
+    FILE *out = diagOutput;
+    if(!hoshinoOptions.timeReportFile.empty() 
+        && !(out = fopen(hoshinoOptions.timeReportFile.c_str(), "w"))){
+        fprintf(diagOutput, "Error: could not open %s\n", hoshinoOptions.timeReportFile.c_str());
+        return;
+    }
+    if(hoshinoOptions.timeReportJSON)
+        timeReport.PrintJSON(out);
+    else
+        timeReport.Print(out);
+    if(out != diagOutput)
+        fclose(out);
+}
+
+int ContextClose(){
+    if(!theJIT){
+        bool ok = EmitAOTOutput();
+        WriteReports();
+        return ok ? 0 : 1;
+    }
+    if(hoshinoOptions.wholeProgram)
+        RunWholeProgram();
+    theModule->print(diags(), nullptr);
+#ifdef DEBUG
+    if(!theJIT->isUsingJITLink())
+        theJIT->getMemoryPool().printStats(diags());
+    if(auto *cache = theJIT->getObjectCache())
+        cache->printStats(diags());
+    diags() << "code reclaim: live definitions=" << theJIT->getReclaimer().getLiveDefinitions()
+        << " reclaimed definitions=" << theJIT->getReclaimer().getReclaimedDefinitions()
+        << " live bytes=" << theJIT->getCodeStats().getLiveBytes()
+        << " reclaimed bytes=" << theJIT->getCodeStats().getReclaimedBytes() << "\n";
+    diags().flush();
+    hoshino_memo_print_stats(diagOutput, "");
+#endif
+    if(hoshinoOptions.profile)
+        hoshino_profile_report(diagOutput);
+    WriteReports();
+    return 0;
+}
@@ -1,6 +1,7 @@
 #include "lexer/token.h"
 #include "ast/basic_ast.h"
 #include "tools/basic_tool.h"
+#include "tools/time_report.h"
 #include <cctype>
 #include <charconv>
 #include <cstddef>
@@ -29,17 +30,31 @@ static std::unique_ptr<ExprAST> ParseUnary();
 static std::unique_ptr<ExprAST> ParseBlockExpr();
 static std::unique_ptr<ExprAST> ParseIfExpr();
 static std::unique_ptr<ExprAST> ParseForExpr();
-static std::unique_ptr<PrototypeAST> ParsePrototype();
+static std::unique_ptr<ExprAST> ParseParforExpr();
+static std::unique_ptr<ExprAST> ParseSpawnExpr();
+static std::unique_ptr<ExprAST> ParseAwaitExpr();
+static std::unique_ptr<PrototypeAST> ParsePrototype(bool isExtern = false);
 static std::unique_ptr<ExprAST> ParseBinOpRHS(int exprPrece, 
                 std::unique_ptr<ExprAST>lhs);
 static int GetTokPrecedence();
 
-static int lastChar = ' ';
+static thread_local int lastChar = ' ';
 
-static int globalFuncCounting = 0;
+static thread_local int globalFuncCounting = 0;
+
+// 读入的字符数 --time-report中作为lex阶段的字节数
+static thread_local uint64_t charsRead = 0;
+
+// 当前读到的行号 以及curTok开始的行号
+static thread_local unsigned curLine = 1;
+static thread_local unsigned tokLine = 1;
 
 static int GetChar(){
-    return sourceInput->get();
+    ++charsRead;
+    int c = sourceInput->get();
+    if(c == '\n')
+        ++curLine;
+    return c;
 }
 static Token GetTok(){
     while(std::isspace(lastChar)){
@@ -48,6 +63,7 @@ static Token GetTok(){
         //     std::cout << "there!!!" << '\n';
         // }
     }
+    tokLine = curLine;
     // token以字母开头
     if(std::isalpha(lastChar)){
         identifierStr = lastChar;
@@ -73,6 +89,20 @@ static Token GetTok(){
             return Token{TokenNum::TOK_UNARY};
         if(identifierStr == "var")
             return Token{TokenNum::TOK_VAR};
+        if(identifierStr == "undef")
+            return Token{TokenNum::TOK_UNDEF};
+        if(identifierStr == "pure")
+            return Token{TokenNum::TOK_PURE};
+        if(identifierStr == "parfor")
+            return Token{TokenNum::TOK_PARFOR};
+        if(identifierStr == "spawn")
+            return Token{TokenNum::TOK_SPAWN};
+        if(identifierStr == "await")
+            return Token{TokenNum::TOK_AWAIT};
+        if(identifierStr == "sync")
+            return Token{TokenNum::TOK_SYNC};
+        if(identifierStr == "import")
+            return Token{TokenNum::TOK_IMPORT};
         return Token{TokenNum::TOK_IDENTIFIER};
     }
     // token以数字开头
@@ -122,7 +152,22 @@ static Token GetTok(){
 }
 
 int GetNextToken(){
-    return curTok = GetTok();
+    PhaseTimer timer{Phase::Lex};
+    uint64_t before = charsRead;
+    curTok = GetTok();
+    timer.AddBytes(charsRead - before);
+    return curTok;
+}
+
+unsigned GetTokenLine(){
+    return tokLine;
+}
+
+void ResetLexer(){
+    lastChar = ' ';
+    curLine = tokLine = 1;
+    identifierStr.clear();
+    numVal = 0;
 }
 
 static std::string ReadNTok(size_t n){
@@ -131,6 +176,7 @@ static std::string ReadNTok(size_t n){
     int tempChar = lastChar;
     std::string tempIdentifier = identifierStr;
     int tempNum = numVal;
+    unsigned tempLine = curLine, tempTokLine = tokLine;
     std::string res{};
     auto curPos = sourceInput->tellg();
     // std::cout << "current pos is: " << curPos << '\n'; 
@@ -152,6 +198,8 @@ static std::string ReadNTok(size_t n){
     identifierStr = tempIdentifier;
     numVal = tempNum;
     lastChar = tempChar;
+    curLine = tempLine;
+    tokLine = tempTokLine;
     return res;
 }
 
@@ -249,6 +297,15 @@ static std::unique_ptr<ExprAST> ParsePrimary(){
             return ParseIfExpr();
         case TOK_FOR:
             return ParseForExpr();
+        case TOK_PARFOR:
+            return ParseParforExpr();
+        case TOK_SPAWN:
+            return ParseSpawnExpr();
+        case TOK_AWAIT:
+            return ParseAwaitExpr();
+        case TOK_SYNC:
+            GetNextToken(); // eat sync
+            return std::make_unique<SyncExprAST>();
         case TOK_VAR:
             return ParseVarExpr();
         case '(':
@@ -427,9 +484,106 @@ static std::unique_ptr<ExprAST> ParseForExpr(){
 
 }
 
+/*
+    parfor i = start; i < bound; [step] [grain g] [reduce op var]... { body }
+    grain与reduce不是关键字 只在parfor的步长位置识别
+*/
+static std::unique_ptr<ExprAST> ParseParforExpr(){
+    GetNextToken(); // eat parfor
+    if(curTok != TOK_IDENTIFIER)
+        return LOG_ERROR("expected identifier after parfor");
+    auto idName = identifierStr;
+    GetNextToken(); // eat initial variable
+    if(curTok != '=')
+        return LOG_ERROR("expected '=' after identifier in parfor expr");
+    GetNextToken(); // eat =
+    auto start = ParseExpression();
+    if(!start)
+        return nullptr;
+    if(curTok != TOK_EXPR_END)
+        return LOG_ERROR("expected ';' after parfor start value");
+    GetNextToken(); // eat ;
+    // 迭代次数要在循环开始前确定 所以条件只能是 i < bound
+    if(curTok != TOK_IDENTIFIER || identifierStr != idName)
+        return LOG_ERROR("parfor condition must be '<loop variable> < bound'");
+    GetNextToken(); // eat loop variable
+    if(curTok != '<')
+        return LOG_ERROR("parfor condition must be '<loop variable> < bound'");
+    GetNextToken(); // eat <
+    auto bound = ParseExpression();
+    if(!bound)
+        return nullptr;
+    if(curTok != TOK_EXPR_END)
+        return LOG_ERROR("expected ';' after parfor bound");
+    GetNextToken(); // eat ;
+    auto isClause = []{ 
+        return curTok == TOK_IDENTIFIER && (identifierStr == "grain" || identifierStr == "reduce"); 
+    };
+    std::unique_ptr<ExprAST>step, grain;
+    if(curTok != '{' && !isClause()){
+        step = ParseExpression();
+        if(!step)
+            return nullptr;
+    }
+    std::vector<std::pair<std::string, std::string>>reductions;
+    while(isClause()){
+        if(identifierStr == "grain"){
+            GetNextToken(); // eat grain
+            grain = ParsePrimary();
+            if(!grain)
+                return nullptr;
+            continue;
+        }
+        GetNextToken(); // eat reduce
+        std::string op;
+        if(curTok == '+' || curTok == '*')
+            op = std::string(1, (char)curTok);
+        else if(curTok == TOK_IDENTIFIER && (identifierStr == "min" || identifierStr == "max"))
+            op = identifierStr;
+        else
+            return LOG_ERROR("expected '+', '*', 'min' or 'max' after reduce");
+        GetNextToken(); // eat op
+        if(curTok != TOK_IDENTIFIER)
+            return LOG_ERROR("expected variable name in reduce clause");
+        reductions.emplace_back(op, identifierStr);
+        GetNextToken(); // eat variable
+    }
+    if(curTok != '{')
+        return LOG_ERROR("expected '{' after parfor's step");
+    auto body = ParseExpression();
+    if(!body)
+        return nullptr;
+    if(curTok == TOK_EXPR_END)
+        GetNextToken(); //eat ;
+    return std::make_unique<ParforExprAST>(idName, std::move(start), std::move(bound), 
+        std::move(step), std::move(grain), std::move(reductions), std::move(body));
+}
+// spawn f(args) spawn之后必须是函数调用
+static std::unique_ptr<ExprAST> ParseSpawnExpr(){
+    GetNextToken(); // eat spawn
+    if(curTok != TOK_IDENTIFIER)
+        return LOG_ERROR("expected a function call after spawn");
+    auto expr = ParseIdentifierExpr();
+    if(!expr)
+        return nullptr;
+    std::unique_ptr<CallExprAST>call{dynamic_cast<CallExprAST*>(expr.get())};
+    if(!call)
+        return LOG_ERROR("expected a function call after spawn");
+    expr.release();
+    return std::make_unique<SpawnExprAST>(std::move(call));
+}
 
-// 解析函数原型
-static std::unique_ptr<PrototypeAST> ParsePrototype(){
+// await handle
+static std::unique_ptr<ExprAST> ParseAwaitExpr(){
+    GetNextToken(); // eat await
+    auto handle = ParsePrimary();
+    if(!handle)
+        return nullptr;
+    return std::make_unique<AwaitExprAST>(std::move(handle));
+}
+
+// 解析函数原型 extern的参数与返回值可以标注类型
+static std::unique_ptr<PrototypeAST> ParsePrototype(bool isExtern){
     
     std::string fnName;
     /*
@@ -480,18 +634,48 @@ static std::unique_ptr<PrototypeAST> ParsePrototype(){
     if(curTok != '(')
         return LOG_ERROR_P("Expected '(' in prototype");
     std::vector<std::string>args;
-    // eat (
-    while(GetNextToken() == TOK_IDENTIFIER){ 
+    std::vector<NativeType>argsType;
+    bool isTyped = false;
+    GetNextToken(); // eat (
+    while(curTok == TOK_IDENTIFIER){ 
         args.push_back(identifierStr);
+        argsType.push_back(NativeType::F64);
+        GetNextToken(); // eat arg
+        // x: i32
+        if(isExtern && curTok == ':'){
+            GetNextToken(); // eat :
+            if(curTok != TOK_IDENTIFIER || !ParseNativeType(identifierStr, argsType.back())
+                || argsType.back() == NativeType::Void)
+                return LOG_ERROR_P("expected a parameter type (i32, i64, f32, f64, ptr) after ':'");
+            GetNextToken(); // eat type
+            isTyped = true;
+        }
     }
     if(curTok != ')')
         return LOG_ERROR_P("Expected ')' in prototype");
     GetNextToken(); // eat )
+    // -> i32
+    NativeType returnType = NativeType::F64;
+    if(isExtern && curTok == '-'){
+        GetNextToken(); // eat -
+        if(curTok != '>')
+            return LOG_ERROR_P("expected '->' before the return type");
+        GetNextToken(); // eat >
+        if(curTok != TOK_IDENTIFIER || !ParseNativeType(identifierStr, returnType))
+            return LOG_ERROR_P("expected a return type (i32, i64, f32, f64, ptr, void) after '->'");
+        GetNextToken(); // eat type
+        isTyped = true;
+    }
     if(kindOfProto && args.size()!=kindOfProto)
         return LOG_ERROR_P("Invalid number of operands for operator");
-    return std::make_unique<PrototypeAST>(
+    if(kindOfProto && isTyped)
+        return LOG_ERROR_P("operators can not have native types");
+    auto proto = std::make_unique<PrototypeAST>(
         fnName, std::move(args),
          kindOfProto!=0, binaryPrece);
+    if(isTyped)
+        proto->SetNativeTypes(std::move(argsType), returnType);
+    return proto;
 }
 
 std::unique_ptr<ExprAST> ParseBlockExpr(){
@@ -509,7 +693,7 @@ std::unique_ptr<ExprAST> ParseBlockExpr(){
             // typeid的参数应该是一个纯粹的类型表达式 
             // 因此最好不要使用求值表达式 如：*expr等
             isIfExpr = (typeid(tmpExpr) == typeid(IfExprAST));
-            isForExpr = (typeid(tmpExpr) == typeid(ForExprAST));
+            isForExpr = (typeid(tmpExpr) == typeid(ForExprAST) || typeid(tmpExpr) == typeid(ParforExprAST));
         }
         // auto temp1 = dynamic_cast<IfExprAST*>(expr.get());
         // auto temp2 = dynamic_cast<ForExprAST*>(expr.get());
@@ -529,9 +713,14 @@ std::unique_ptr<ExprAST> ParseBlockExpr(){
 
 std::unique_ptr<FunctionAST>ParseDefinition(){
     GetNextToken(); // eat def
+    // def pure f(...) 没有副作用的函数 结果按参数缓存
+    bool isPure = curTok == TOK_PURE;
+    if(isPure)
+        GetNextToken(); // eat pure
     auto proto = ParsePrototype();
     if(!proto)
         return nullptr;
+    proto->SetPure(isPure);
     if(auto body = ParseExpression())
         return std::make_unique<FunctionAST>(std::move(proto), std::move(body));
     else{
@@ -542,7 +731,53 @@ std::unique_ptr<FunctionAST>ParseDefinition(){
 
 std::unique_ptr<PrototypeAST> ParseExtern(){
     GetNextToken(); // eat extern
-    return ParsePrototype();
+    return ParsePrototype(true);
+}
+
+std::string ParseUndef(){
+    GetNextToken(); // eat undef
+    std::string fnName;
+    switch (curTok) {
+    case TOK_IDENTIFIER:
+        fnName = identifierStr;
+        GetNextToken(); // eat fnName
+        break;
+    case TOK_UNARY:
+        GetNextToken(); // eat unary
+        if(curTok != '@'){
+            LOG_ERROR("expected '@' after unary");
+            return {};
+        }
+        GetNextToken(); // eat @
+        fnName = "unary@";
+        fnName += (char)curTok;
+        GetNextToken(); // eat op
+        break;
+    case TOK_BINARY:
+        GetNextToken(); // eat binary
+        if(curTok != '@'){
+            LOG_ERROR("expected '@' after binary");
+            return {};
+        }
+        GetNextToken(); // eat @
+        fnName = "binary@" + GetBinaryOp();
+        break;
+    default:
+        LOG_ERROR("expected function name after undef");
+        return {};
+    }
+    return fnName;
+}
+
+std::string ParseImport(){
+    GetNextToken(); // eat import
+    if(curTok != TOK_STR){
+        LOG_ERROR("expected a library path string after import");
+        return {};
+    }
+    std::string path = identifierStr;
+    GetNextToken(); // eat path
+    return path;
 }
 
 /*
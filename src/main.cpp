@@ -1,14 +1,200 @@
 #include "context.h"
-#include <cassert>
+#include "tools/options.h"
+#include "server/server.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
 
 
+static void PrintUsage(const char *prog){
+    fprintf(stderr, "usage: %s [options] <source file>\n", prog);
+    fprintf(stderr, "options:\n");
+    fprintf(stderr, "  --jitlink        link JIT objects with JITLink instead of RuntimeDyld\n");
+    fprintf(stderr, "  --object-cache   cache compiled objects on disk (default dir ~/.cache/hoshino)\n");
+    fprintf(stderr, "  --cache-dir=DIR  object cache directory (implies --object-cache)\n");
+    fprintf(stderr, "  --emit-obj       compile the whole file ahead of time to a native object\n");
+    fprintf(stderr, "  --emit-exe       compile the whole file to an executable linked against builtin_lib\n");
+    fprintf(stderr, "  -o FILE          output file for --emit-obj/--emit-exe\n");
+    fprintf(stderr, "  --cache-size=MB  object cache size limit, least recently used objects are evicted\n");
+    fprintf(stderr, "  --whole-program  parse the whole file into one module and run interprocedural optimization\n");
+    fprintf(stderr, "  --memo-size=N    results cached per 'def pure' function (default 65536)\n");
+    fprintf(stderr, "  --output=stdout|stderr|FILE  where printNum/putchard write (default stderr)\n");
+    fprintf(stderr, "  --time-report[=json]  print wall/CPU time, counts and bytes per compile phase at exit\n");
+    fprintf(stderr, "  --time-report-file=PATH  write the time report to PATH instead of stderr\n");
+    fprintf(stderr, "  --trace=FILE     write a Chrome trace (Perfetto) of the compile pipeline to FILE at exit\n");
+    fprintf(stderr, "  --perf=map|jitdump  describe JIT functions to perf in /tmp/perf-<pid>.map or /tmp/jit-<pid>.dump\n");
+    fprintf(stderr, "  --profile        count calls, time and loop trips of every function and print a table at exit\n");
+    fprintf(stderr, "  --remarks[=KINDS]  collect LLVM optimization remarks, KINDS is a comma list of passed,missed,analysis (default all)\n");
+    fprintf(stderr, "  --remarks-format=text|yaml  print remarks grouped by definition (text) or as opt-viewer YAML\n");
+    fprintf(stderr, "  --remarks-file=PATH  write remarks to PATH instead of stderr\n");
+    fprintf(stderr, "  --remarks-filter=REGEX  only keep remarks from passes matching REGEX\n");
+    fprintf(stderr, "  --mem-report     print AST, IR and JIT memory usage before exiting\n");
+    fprintf(stderr, "  --mem-limit=MB   soft limit on accounted memory (JIT code/data and AST)\n");
+    fprintf(stderr, "  --mem-limit-action=warn|evict  warn, or reclaim unreachable code first (default warn)\n");
+    fprintf(stderr, "  --no-inline-operators  call user-defined operators through the JIT instead of inlining their bodies\n");
+    fprintf(stderr, "  --reclaim=POLICY free unreachable code on 'undef' (explicit, default) or after every statement (auto)\n");
+    fprintf(stderr, "  --daemon         run as a compile server, scripts are submitted with hoshino-client\n");
+    fprintf(stderr, "  --socket=PATH    unix socket of the compile server (default /tmp/hoshino-<uid>.sock)\n");
+    fprintf(stderr, "  --prelude=FILE   definitions loaded once by the compile server and shared by all scripts\n");
+}
+
+// --remarks=passed,missed,analysis 返回RemarkKind的组合 有未知的种类时返回0
+static unsigned ParseRemarkKinds(const std::string &value){
+    if(value.empty())
+        return RemarkPassed | RemarkMissed | RemarkAnalysis;
+    unsigned kinds = 0;
+    size_t begin = 0;
+    while(begin <= value.size()){
+        size_t end = value.find(',', begin);
+        if(end == std::string::npos)
+            end = value.size();
+        std::string kind = value.substr(begin, end - begin);
+        if(kind == "passed")
+            kinds |= RemarkPassed;
+        else if(kind == "missed")
+            kinds |= RemarkMissed;
+        else if(kind == "analysis")
+            kinds |= RemarkAnalysis;
+        else
+            return 0;
+        begin = end + 1;
+    }
+    return kinds;
+}
+
+// 解析--cache-size等选项的非负整数值 空值 负数 非数字的后缀和溢出都返回false
+static bool ParseCount(const std::string &value, unsigned long long &count){
+    if(value.empty() || value[0] == '-')
+        return false;
+    char *end = nullptr;
+    errno = 0;
+    count = std::strtoull(value.c_str(), &end, 10);
+    return errno == 0 && end != value.c_str() && *end == '\0';
+}
+
+bool ParseOptions(int argc, char* argv[]){
+    for(int i=1;i<argc;++i){
+        std::string arg = argv[i];
+        // --name=value形式的选项
+        std::string value;
+        if(auto pos = arg.find('='); arg.rfind("--", 0) == 0 && pos != std::string::npos){
+            value = arg.substr(pos + 1);
+            arg = arg.substr(0, pos);
+        }
+        if(arg == "--jitlink"){
+            hoshinoOptions.useJITLink = true;
+        }else if(arg == "--object-cache"){
+            hoshinoOptions.objectCache = true;
+        }else if(arg == "--cache-dir" && !value.empty()){
+            hoshinoOptions.objectCache = true;
+            hoshinoOptions.cacheDir = value;
+        }else if(arg == "--cache-size" || arg == "--memo-size" || arg == "--mem-limit"){
+            unsigned long long count;
+            if(!ParseCount(value, count)){
+                fprintf(stderr, "Error: %s requires a non-negative integer, got '%s'\n", arg.c_str(), value.c_str());
+                PrintUsage(argv[0]);
+                return false;
+            }
+            if(arg == "--cache-size")
+                hoshinoOptions.cacheSizeMB = count;
+            else if(arg == "--memo-size")
+                hoshinoOptions.memoSize = count;
+            else
+                hoshinoOptions.memLimitMB = count;
+        }else if(arg == "--output" && !value.empty()){
+            hoshinoOptions.outputTarget = value;
+        }else if(arg == "--emit-obj"){
+            hoshinoOptions.emitMode = EmitMode::Object;
+        }else if(arg == "--emit-exe"){
+            hoshinoOptions.emitMode = EmitMode::Executable;
+        }else if(arg == "--reclaim" && (value == "explicit" || value == "auto")){
+            hoshinoOptions.reclaimPolicy = 
+                value == "auto" ? ReclaimPolicy::Auto : ReclaimPolicy::Explicit;
+        }else if(arg == "--whole-program"){
+            hoshinoOptions.wholeProgram = true;
+        }else if(arg == "--time-report" && (value.empty() || value == "text" || value == "json")){
+            hoshinoOptions.timeReport = true;
+            hoshinoOptions.timeReportJSON = value == "json";
+        }else if(arg == "--time-report-file" && !value.empty()){
+            hoshinoOptions.timeReport = true;
+            hoshinoOptions.timeReportFile = value;
+        }else if(arg == "--trace" && !value.empty()){
+            hoshinoOptions.traceFile = value;
+        }else if(arg == "--perf" && (value == "map" || value == "jitdump")){
+            hoshinoOptions.perf = value == "map" ? PerfSupport::Map : PerfSupport::JitDump;
+        }else if(arg == "--profile"){
+            hoshinoOptions.profile = true;
+        }else if(arg == "--remarks" && ParseRemarkKinds(value)){
+            hoshinoOptions.remarkKinds = ParseRemarkKinds(value);
+        }else if(arg == "--remarks-format" && (value == "text" || value == "yaml")){
+            hoshinoOptions.remarksYAML = value == "yaml";
+        }else if(arg == "--remarks-file" && !value.empty()){
+            hoshinoOptions.remarksFile = value;
+            if(!hoshinoOptions.remarkKinds)
+                hoshinoOptions.remarkKinds = ParseRemarkKinds("");
+        }else if(arg == "--remarks-filter" && !value.empty()){
+            hoshinoOptions.remarksFilter = value;
+        }else if(arg == "--mem-report"){
+            hoshinoOptions.memReport = true;
+        }else if(arg == "--mem-limit-action" && (value == "warn" || value == "evict")){
+            hoshinoOptions.memLimitEvict = value == "evict";
+        }else if(arg == "--no-inline-operators"){
+            hoshinoOptions.inlineOperators = false;
+        }else if(arg == "--daemon"){
+            hoshinoOptions.daemon = true;
+        }else if(arg == "--socket" && !value.empty()){
+            hoshinoOptions.socketPath = value;
+        }else if(arg == "--prelude" && !value.empty()){
+            hoshinoOptions.preludeFile = value;
+        }else if(arg == "-o"){
+            if(i + 1 >= argc){
+                fprintf(stderr, "Error: -o requires a file\n");
+                PrintUsage(argv[0]);
+                return false;
+            }
+            hoshinoOptions.outputFile = argv[++i];
+        }else if(arg == "-h" || arg == "--help"){
+            PrintUsage(argv[0]);
+            return false;
+        }else if(arg.rfind("--", 0) == 0){
+            fprintf(stderr, "Error: unknown option '%s'\n", arg.c_str());
+            PrintUsage(argv[0]);
+            return false;
+        }else{
+            hoshinoOptions.sourceFile = arg;
+        }
+    }
+    if(hoshinoOptions.daemon){
+        // 守护进程只支持增量的JIT模式
+        hoshinoOptions.emitMode = EmitMode::JIT;
+        hoshinoOptions.wholeProgram = false;
+        return true;
+    }
+    if(hoshinoOptions.sourceFile.empty()){
+        PrintUsage(argv[0]);
+        return false;
+    }
+    if(hoshinoOptions.emitMode != EmitMode::JIT && hoshinoOptions.outputFile.empty()){
+        std::string stem = hoshinoOptions.sourceFile;
+        auto slash = stem.find_last_of('/');
+        auto dot = stem.find_last_of('.');
+        if(dot != std::string::npos && (slash == std::string::npos || dot > slash))
+            stem = stem.substr(0, dot);
+        hoshinoOptions.outputFile = 
+            hoshinoOptions.emitMode == EmitMode::Object ? stem + ".o" : stem;
+        if(hoshinoOptions.outputFile == hoshinoOptions.sourceFile)
+            hoshinoOptions.outputFile += ".out";
+    }
+    return true;
+}
+
 int main(int argc, char* argv[]){
-    // for(int i=0;i<argc;++i){
-    //     std::cout << argv[i] << '\n';
-    // }
-    assert((argc > 1) && "should specify a source file name");
-    std::string sourceFile = argv[1];
-    SettingContext(sourceFile);
+    if(!ParseOptions(argc, argv))
+        return 1;
+    if(hoshinoOptions.daemon)
+        return RunServer();
+    SettingContext(hoshinoOptions.sourceFile);
     MainLoop();
-    ContextClose();
-}
\ No newline at end of file
+    return ContextClose();
+}
@@ -0,0 +1,65 @@
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "server/protocol.h"
+
+using namespace hoshino::server;
+
+/*
+    hoshino-client: 把脚本提交给hoshino守护进程运行
+    程序的输出原样写到stderr(与直接运行hoshino时一致) 退出状态为程序的退出状态
+*/
+int main(int argc, char* argv[]){
+    std::string socketPath = DefaultSocketPath();
+    std::string sourceFile;
+    for(int i=1;i<argc;++i){
+        std::string arg = argv[i];
+        if(arg.rfind("--socket=", 0) == 0)
+            socketPath = arg.substr(9);
+        else
+            sourceFile = arg;
+    }
+    if(sourceFile.empty()){
+        fprintf(stderr, "usage: %s [--socket=PATH] <source file>\n", argv[0]);
+        return 2;
+    }
+    std::ifstream input(sourceFile);
+    if(!input){
+        fprintf(stderr, "Error: cannot open '%s'\n", sourceFile.c_str());
+        return 2;
+    }
+    std::stringstream source;
+    source << input.rdbuf();
+
+    sockaddr_un addr;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0 || !FillSocketAddr(socketPath, addr) ||
+       connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0){
+        fprintf(stderr, "Error: cannot connect to hoshino daemon at '%s'\n", socketPath.c_str());
+        return 2;
+    }
+    if(!WriteRequest(fd, source.str())){
+        fprintf(stderr, "Error: failed to send the script\n");
+        return 2;
+    }
+    char type;
+    std::string payload;
+    while(ReadFrame(fd, type, payload)){
+        if(type == frameOutput){
+            fwrite(payload.data(), 1, payload.size(), stderr);
+        }else if(type == frameExit && payload.size() == sizeof(uint32_t)){
+            uint32_t status;
+            std::memcpy(&status, payload.data(), sizeof(status));
+            close(fd);
+            return static_cast<int>(ntohl(status));
+        }
+    }
+    fprintf(stderr, "Error: connection to hoshino daemon lost\n");
+    close(fd);
+    return 2;
+}
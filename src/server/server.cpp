@@ -0,0 +1,154 @@
+#include <csignal>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/raw_ostream.h>
+#include "jit/HoshinoJIT.h"
+#include "lexer/token.h"
+#include "code_gen/ir.h"
+#include "tools/options.h"
+#include "tools/basic_tool.h"
+#include "server/protocol.h"
+#include "lib.h"
+#include "server/server.h"
+#include "context.h"
+
+using namespace hoshino::server;
+
+static std::string socketPath;
+
+static void HandleTermination(int){
+    unlink(socketPath.c_str());
+    _exit(0);
+}
+
+/*
+    在PreludeJD中加载prelude(例如常用的运算符定义) 加载完成后全部编译好
+    之后每个程序的dylib都链接到PreludeJD上 直接调用已编译的代码 不会随程序结束而被清除
+*/
+static bool LoadPrelude(const std::string&file){
+    auto input = std::make_unique<std::ifstream>(file);
+    if(!*input){
+        fprintf(stderr, "Error: cannot open prelude '%s'\n", file.c_str());
+        return false;
+    }
+    sourceInput = std::move(input);
+    theJIT->setCurrentJITDylib(theJIT->getPreludeJITDylib());
+    ResetLexer();
+    GetNextToken();
+    MainLoop();
+    if(auto err = theJIT->compilePrelude()){
+        llvm::logAllUnhandledErrors(std::move(err), llvm::errs(), "Error: ");
+        ++errorCount;
+    }
+    theJIT->setCurrentJITDylib(theJIT->getMainJITDylib());
+    return errorCount == 0;
+}
+
+/*
+    程序的输出(builtin_lib的putchard/printNum、前端的诊断信息)写到这个FILE中
+    每次写入打包成一个'O'帧发给客户端 客户端断开后输出被丢弃 程序照常运行结束
+*/
+static ssize_t WriteOutputFrame(void *cookie, const char *buf, size_t size){
+    WriteFrame(*static_cast<int*>(cookie), frameOutput, buf, size);
+    return size;
+}
+
+static FILE *OpenClientOutput(int&clientFd){
+    cookie_io_functions_t io = {nullptr, WriteOutputFrame, nullptr, nullptr};
+    FILE *out = fopencookie(&clientFd, "w", io);
+    if(out)
+        setvbuf(out, nullptr, _IOLBF, 4096);
+    return out;
+}
+
+// 在一个新的程序JITDylib中运行客户端提交的脚本 返回程序的退出状态
+static uint32_t RunProgram(std::string source){
+    auto&programJD = theJIT->acquireProgramDylib();
+    theJIT->setCurrentJITDylib(programJD);
+    ResetFrontendState();
+    sourceInput = std::make_unique<std::istringstream>(std::move(source));
+    GetNextToken();
+    MainLoop();
+    uint32_t status = errorCount > 0 ? 1 : 0;
+    // 程序的JITDylib会被下一个程序复用 释放按名字创建的memo表 以免下一个程序读到旧的结果
+    hoshino_memo_release((programJD.getName() + "/").c_str());
+    // 清空该程序的JITDylib 其中的函数与内存全部释放 JITDylib留给下一个程序复用
+    if(auto err = theJIT->releaseProgramDylib(programJD)){
+        llvm::logAllUnhandledErrors(std::move(err), diags(), "Error: ");
+        status = 1;
+    }
+    // 丢弃程序留下的未提交到JIT的module
+    InitModuleAndManager();
+    return status;
+}
+
+// 每个连接在自己的线程中处理 前端状态是thread_local的 多个程序可以同时编译运行
+static void ServeClient(int clientFd){
+    std::string source;
+    if(ReadRequest(clientFd, source)){
+        uint32_t status = 1;
+        if(FILE *out = OpenClientOutput(clientFd)){
+            diagOutput = out;
+            SetBuiltinOutput(out);
+            status = RunProgram(std::move(source));
+            SetBuiltinOutput(nullptr);
+            diagOutput = stderr;
+            fclose(out);
+        }
+        status = htonl(status);
+        WriteFrame(clientFd, frameExit, &status, sizeof(status));
+    }
+    close(clientFd);
+}
+
+int RunServer(){
+    socketPath = hoshinoOptions.socketPath.empty() ? DefaultSocketPath() : hoshinoOptions.socketPath;
+    InitContext();
+    if(!hoshinoOptions.preludeFile.empty() && !LoadPrelude(hoshinoOptions.preludeFile))
+        return 1;
+    SavePreludeState();
+
+    sockaddr_un addr;
+    if(!FillSocketAddr(socketPath, addr)){
+        fprintf(stderr, "Error: socket path too long '%s'\n", socketPath.c_str());
+        return 1;
+    }
+    int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(listenFd < 0){
+        perror("socket");
+        return 1;
+    }
+    unlink(socketPath.c_str());
+    if(bind(listenFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(listenFd, 16) != 0){
+        perror("bind");
+        close(listenFd);
+        return 1;
+    }
+    // 客户端中途断开时write返回EPIPE而不是杀死守护进程
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, HandleTermination);
+    signal(SIGTERM, HandleTermination);
+    fprintf(stderr, "hoshino daemon listening on %s\n", socketPath.c_str());
+
+    while(true){
+        int clientFd = accept(listenFd, nullptr, nullptr);
+        if(clientFd < 0){
+            if(errno == EINTR)
+                continue;
+            perror("accept");
+            break;
+        }
+        std::thread(ServeClient, clientFd).detach();
+    }
+    close(listenFd);
+    unlink(socketPath.c_str());
+    return 1;
+}